@@ -0,0 +1,38 @@
+#version 330 core
+layout (location = 0) in vec3 position;  // fraction of the bounds
+layout (location = 2) in vec2 normal;    // octahedral
+
+out vec3 worldPosition;
+out vec3 worldNormal;
+
+// per frame and shared by every program, see FrameUniforms
+layout (std140) uniform Frame
+{
+	mat4 view;
+	mat4 projection;
+	vec3 light;
+};
+
+uniform mat4 model;
+
+uniform vec3 boundsMin;
+uniform vec3 boundsSize;
+
+// octahedral normal back onto the unit sphere
+vec3 decodeNormal(vec2 encoded)
+{
+	vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	float fold = max(-normal.z, 0.0);
+	normal.x += normal.x >= 0.0 ? -fold : fold;
+	normal.y += normal.y >= 0.0 ? -fold : fold;
+	return normalize(normal);
+}
+
+void main()
+{
+	vec4 modelPosition = model * vec4(boundsMin + position * boundsSize, 1.0);
+	gl_Position = projection * view * modelPosition;
+
+	worldPosition = vec3(modelPosition);
+	worldNormal = vec3(model * vec4(decodeNormal(normal), 0));
+}
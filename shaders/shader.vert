@@ -1,26 +1,45 @@
 #version 330 core
-layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 barycentric;
-layout (location = 2) in vec3 normal;
+layout (location = 0) in vec3 position;  // fraction of the bounds
+layout (location = 2) in vec2 normal;    // octahedral
 
 out vec3 vertColor;
 out vec3 vertBarycentric;
 
+// per frame and shared by every program, see FrameUniforms
+layout (std140) uniform Frame
+{
+	mat4 view;
+	mat4 projection;
+	vec3 light;
+};
+
 uniform bool showWireframe;
 
-uniform vec3 light;
 uniform vec3 color;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+uniform vec3 boundsMin;
+uniform vec3 boundsSize;
+
+// octahedral normal back onto the unit sphere
+vec3 decodeNormal(vec2 encoded)
+{
+	vec3 normal = vec3(encoded, 1.0 - abs(encoded.x) - abs(encoded.y));
+	float fold = max(-normal.z, 0.0);
+	normal.x += normal.x >= 0.0 ? -fold : fold;
+	normal.y += normal.y >= 0.0 ? -fold : fold;
+	return normalize(normal);
+}
 
 void main()
 {
-	gl_Position = projection * view * model * vec4(position, 1.0);
+	gl_Position = projection * view * model * vec4(boundsMin + position * boundsSize, 1.0);
 
-	float diffuse = max(dot(vec3(model * vec4(normal, 0)), -light), 0.0);
+	float diffuse = max(dot(vec3(model * vec4(decodeNormal(normal), 0)), -light), 0.0);
 	vertColor = (color * 0.5) + (diffuse * 0.5);
 
-	vertBarycentric = barycentric;
+	// every face has its own three corners, in order
+	int corner = gl_VertexID % 3;
+	vertBarycentric = vec3(corner == 0, corner == 1, corner == 2);
 }
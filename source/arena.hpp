@@ -0,0 +1,99 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <stdlib.h>
+#include <utility>
+#include <vector>
+
+// Bump allocator for memory that only lives until the next reset(). Requests
+// that do not fit the block are served by the system and remembered; the
+// next reset() frees them and grows the block to the peak just seen, so a
+// build that repeats runs entirely out of the block.
+struct Arena
+{
+    U8* block = nullptr;
+    U64 capacity = 0;
+    U64 used = 0;
+    U64 overflowSize = 0;
+
+    std::vector<void*> overflowBlocks;
+
+    Arena() {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    Arena(Arena&& other)
+    {
+        *this = std::move(other);
+    }
+
+    Arena& operator=(Arena&& other)
+    {
+        if (this == &other) return *this;
+        release();
+        block = std::exchange(other.block, nullptr);
+        capacity = std::exchange(other.capacity, 0);
+        used = std::exchange(other.used, 0);
+        overflowSize = std::exchange(other.overflowSize, 0);
+        overflowBlocks = std::move(other.overflowBlocks);
+        return *this;
+    }
+
+    ~Arena()
+    {
+        release();
+    }
+
+    // uninitialized room for count values of T, 16-byte aligned like malloc
+    template <typename T>
+    T* allocate(U64 count)
+    {
+        U64 size = (count * sizeof(T) + 15) & ~(U64)15;
+        if (used + size <= capacity)
+        {
+            T* memory = (T*)(block + used);
+            used += size;
+            return memory;
+        }
+
+        void* memory = malloc(size);
+        overflowBlocks.push_back(memory);
+        overflowSize += size;
+        return (T*)memory;
+    }
+
+    void reset()
+    {
+        for (void* memory : overflowBlocks)
+        {
+            free(memory);
+        }
+        overflowBlocks.clear();
+
+        if (0 < overflowSize)
+        {
+            free(block);
+            capacity = used + overflowSize;
+            block = (U8*)malloc(capacity);
+        }
+
+        used = 0;
+        overflowSize = 0;
+    }
+
+    void release()
+    {
+        for (void* memory : overflowBlocks)
+        {
+            free(memory);
+        }
+        overflowBlocks.clear();
+        free(block);
+        block = nullptr;
+        capacity = 0;
+        used = 0;
+        overflowSize = 0;
+    }
+};
@@ -0,0 +1,114 @@
+#pragma once
+
+#include "math.hpp"
+#include "types.hpp"
+
+#include <stdio.h>
+#include <string>
+
+// On-disk layout of a WingedEdgeMesh, written next to its OBJ as "<path>.wem".
+// The in-memory mesh is already made of index arrays, so each one is stored
+// as it is and loading is a straight copy out of the mapped file:
+//
+//   MeshCacheHeader
+//   CachedVertex[vertexCount]
+//   U32[vertexCount]  vertex edges
+//   U32[indexCount]   indices, also the start vertex of every half-edge
+//   U32[edgeCount]    symmetric edges
+//   V3[faceCount]     face normals
+//   CachedMeshlet[meshletCount]
+//
+// All records are 4-byte aligned and stored in native byte order.
+
+const U32 MESH_CACHE_MAGIC = 0x4D455757;  // "WWEM"
+const U32 MESH_CACHE_VERSION = 5;
+
+// an absent reference, e.g. the symmetric edge of an open boundary
+const U32 NO_INDEX = 0xFFFFFFFF;
+
+struct MeshCacheHeader
+{
+    U32 magic;
+    U32 version;
+    U64 sourceHash;  // hashBytes() of the OBJ the mesh was built from
+    U32 vertexCount;
+    U32 indexCount;
+    U32 faceCount;
+    U32 edgeCount;
+    U32 normalWeighting;  // NormalWeighting the vertex normals were computed with
+    U32 meshletCount;
+};
+
+struct CachedVertex
+{
+    V3 position;
+    V3 normal;
+};
+
+// the faces of a meshlet, whose bounds are recomputed from the positions
+struct CachedMeshlet
+{
+    U32 firstFace;
+    U32 facesLength;
+};
+
+std::string getMeshCachePath(const std::string& path)
+{
+    return path + ".wem";
+}
+
+// On-disk layout of a linked shader program, written next to its vertex
+// shader as "<path>.<hash of the stage paths>.glbin": a ProgramCacheHeader
+// and then the bytes glGetProgramBinary returned. A binary is only valid for
+// the driver that made it, so the key covers the GL vendor, renderer and
+// version strings as well as the sources, and anything else is thrown away
+// and relinked.
+const U32 PROGRAM_CACHE_MAGIC = 0x42504C47;  // "GLPB"
+const U32 PROGRAM_CACHE_VERSION = 1;
+
+struct ProgramCacheHeader
+{
+    U32 magic;
+    U32 version;
+    U64 sourceHash;  // hashBytes() of the stage paths and sources
+    U64 driverHash;  // hashBytes() of the GL vendor, renderer and version
+    U32 binaryFormat;
+    U32 binaryLength;
+};
+
+// 64-bit content hash, eight bytes per step. Only used to notice that a
+// source file changed, so it favours speed over strength.
+U64 hashBytes(const void* data, U64 size)
+{
+    const U64 multiplier = 0x9E3779B97F4A7C15ull;
+    const U8* bytes = (const U8*)data;
+    U64       hash = size ^ 0xCBF29CE484222325ull;
+
+    U64 index = 0;
+    for (; index + 8 <= size; index += 8)
+    {
+        U64 word;
+        memcpy(&word, bytes + index, 8);
+        hash = (hash ^ (word * multiplier)) * multiplier;
+        hash ^= hash >> 29;
+    }
+
+    U64 tail = 0;
+    memcpy(&tail, bytes + index, size - index);
+    hash = (hash ^ (tail * multiplier)) * multiplier;
+
+    hash ^= hash >> 32;
+    hash *= multiplier;
+    hash ^= hash >> 29;
+    return hash;
+}
+
+// one file per combination of stages, named by the hash of their paths, so
+// programs that share a vertex shader do not take turns overwriting it
+std::string getProgramCachePath(const char* vertexPath, const char* fragmentPath, const char* geometryPath)
+{
+    std::string paths = std::string(vertexPath) + '\0' + fragmentPath + '\0' + (geometryPath != nullptr ? geometryPath : "");
+    char        suffix[32];
+    snprintf(suffix, sizeof(suffix), ".%016llx.glbin", (unsigned long long)hashBytes(paths.data(), paths.size()));
+    return vertexPath + std::string(suffix);
+}
@@ -0,0 +1,152 @@
+#pragma once
+
+#include "entity.hpp"
+#include "frustum.hpp"
+#include "math.hpp"
+#include "types.hpp"
+
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+// Frustum culling of many entities at once. Their world-space bounds are
+// kept as one array per component, so the planes are tested against eight
+// entities per instruction with AVX, four with SSE, or one at a time
+// elsewhere. The arrays are padded to a whole batch with bounds that are
+// never visible, so no batch needs a tail.
+const U32 CULLING_BATCH_SIZE = 8;
+
+struct BoundingVolumes
+{
+    std::vector<F32> centerX, centerY, centerZ;
+    std::vector<F32> extentX, extentY, extentZ;
+    std::vector<F32> radii;
+    U32              length = 0;
+
+    void resize(U32 newLength)
+    {
+        length = newLength;
+        U32 paddedLength = (newLength + CULLING_BATCH_SIZE - 1) / CULLING_BATCH_SIZE * CULLING_BATCH_SIZE;
+        for (std::vector<F32>* component : {&centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ})
+        {
+            component->resize(paddedLength, 0);
+        }
+
+        // a radius of -FLT_MAX puts every point outside every plane
+        radii.resize(paddedLength);
+        std::fill(radii.begin() + newLength, radii.end(), -FLT_MAX);
+    }
+
+    // the bounds of entity in world space: the box that holds its box once
+    // transformed (Arvo 1990), and its sphere grown by the largest scale
+    void set(U32 index, const Entity& entity)
+    {
+        const M4& m = entity.m;
+        V3        center = entity.boundsCenter;
+        V3        extent = entity.boundsExtent;
+        centerX[index] = center.x * m.x.x + center.y * m.y.x + center.z * m.z.x + m.w.x;
+        centerY[index] = center.x * m.x.y + center.y * m.y.y + center.z * m.z.y + m.w.y;
+        centerZ[index] = center.x * m.x.z + center.y * m.y.z + center.z * m.z.z + m.w.z;
+        extentX[index] = extent.x * fabsf(m.x.x) + extent.y * fabsf(m.y.x) + extent.z * fabsf(m.z.x);
+        extentY[index] = extent.x * fabsf(m.x.y) + extent.y * fabsf(m.y.y) + extent.z * fabsf(m.z.y);
+        extentZ[index] = extent.x * fabsf(m.x.z) + extent.y * fabsf(m.y.z) + extent.z * fabsf(m.z.z);
+
+        F32 scaleX = m.x.x * m.x.x + m.x.y * m.x.y + m.x.z * m.x.z;
+        F32 scaleY = m.y.x * m.y.x + m.y.y * m.y.y + m.y.z * m.y.z;
+        F32 scaleZ = m.z.x * m.z.x + m.z.y * m.z.y + m.z.z * m.z.z;
+        radii[index] = entity.boundsRadius * sqrtf(std::max(scaleX, std::max(scaleY, scaleZ)));
+    }
+};
+
+// Writes the index of every entity whose bounds are not wholly outside a
+// plane of frustum to visibleIndices, in order, and returns how many there
+// are. visibleIndices needs room for the padded length, radii.size(). Per
+// plane, the box and the sphere reach some way either side of the center's
+// distance, and the shorter reach decides.
+U32 cullBoundingVolumes(const Frustum& frustum, const BoundingVolumes& volumes, U32* visibleIndices)
+{
+    U32 paddedLength = volumes.radii.size();
+    U32 visibleLength = 0;
+
+#if defined(__AVX__)
+    __m256 planeX[6], planeY[6], planeZ[6], planeW[6], absoluteX[6], absoluteY[6], absoluteZ[6];
+    for (U32 plane = 0; plane < 6; plane += 1)
+    {
+        V4 p = frustum.planes[plane];
+        planeX[plane] = _mm256_set1_ps(p.x), absoluteX[plane] = _mm256_set1_ps(fabsf(p.x));
+        planeY[plane] = _mm256_set1_ps(p.y), absoluteY[plane] = _mm256_set1_ps(fabsf(p.y));
+        planeZ[plane] = _mm256_set1_ps(p.z), absoluteZ[plane] = _mm256_set1_ps(fabsf(p.z));
+        planeW[plane] = _mm256_set1_ps(p.w);
+    }
+    for (U32 first = 0; first < paddedLength; first += 8)
+    {
+        __m256 x = _mm256_loadu_ps(&volumes.centerX[first]), y = _mm256_loadu_ps(&volumes.centerY[first]), z = _mm256_loadu_ps(&volumes.centerZ[first]);
+        __m256 extentX = _mm256_loadu_ps(&volumes.extentX[first]), extentY = _mm256_loadu_ps(&volumes.extentY[first]), extentZ = _mm256_loadu_ps(&volumes.extentZ[first]);
+        __m256 radius = _mm256_loadu_ps(&volumes.radii[first]);
+        __m256 isOutside = _mm256_setzero_ps();
+        for (U32 plane = 0; plane < 6; plane += 1)
+        {
+            __m256 distance = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(planeX[plane], x), _mm256_mul_ps(planeY[plane], y)), _mm256_add_ps(_mm256_mul_ps(planeZ[plane], z), planeW[plane]));
+            __m256 boxRadius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(absoluteX[plane], extentX), _mm256_mul_ps(absoluteY[plane], extentY)), _mm256_mul_ps(absoluteZ[plane], extentZ));
+            __m256 reach = _mm256_min_ps(boxRadius, radius);
+            isOutside = _mm256_or_ps(isOutside, _mm256_cmp_ps(_mm256_add_ps(distance, reach), _mm256_setzero_ps(), _CMP_LT_OQ));
+        }
+        U32 visibleMask = ~_mm256_movemask_ps(isOutside) & 0xFF;
+        for (U32 lane = 0; lane < 8; lane += 1)
+        {
+            visibleIndices[visibleLength] = first + lane;
+            visibleLength += (visibleMask >> lane) & 1;
+        }
+    }
+#elif defined(__SSE2__) || defined(_M_X64)
+    __m128 planeX[6], planeY[6], planeZ[6], planeW[6], absoluteX[6], absoluteY[6], absoluteZ[6];
+    for (U32 plane = 0; plane < 6; plane += 1)
+    {
+        V4 p = frustum.planes[plane];
+        planeX[plane] = _mm_set1_ps(p.x), absoluteX[plane] = _mm_set1_ps(fabsf(p.x));
+        planeY[plane] = _mm_set1_ps(p.y), absoluteY[plane] = _mm_set1_ps(fabsf(p.y));
+        planeZ[plane] = _mm_set1_ps(p.z), absoluteZ[plane] = _mm_set1_ps(fabsf(p.z));
+        planeW[plane] = _mm_set1_ps(p.w);
+    }
+    for (U32 first = 0; first < paddedLength; first += 4)
+    {
+        __m128 x = _mm_loadu_ps(&volumes.centerX[first]), y = _mm_loadu_ps(&volumes.centerY[first]), z = _mm_loadu_ps(&volumes.centerZ[first]);
+        __m128 extentX = _mm_loadu_ps(&volumes.extentX[first]), extentY = _mm_loadu_ps(&volumes.extentY[first]), extentZ = _mm_loadu_ps(&volumes.extentZ[first]);
+        __m128 radius = _mm_loadu_ps(&volumes.radii[first]);
+        __m128 isOutside = _mm_setzero_ps();
+        for (U32 plane = 0; plane < 6; plane += 1)
+        {
+            __m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(planeX[plane], x), _mm_mul_ps(planeY[plane], y)), _mm_add_ps(_mm_mul_ps(planeZ[plane], z), planeW[plane]));
+            __m128 boxRadius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(absoluteX[plane], extentX), _mm_mul_ps(absoluteY[plane], extentY)), _mm_mul_ps(absoluteZ[plane], extentZ));
+            __m128 reach = _mm_min_ps(boxRadius, radius);
+            isOutside = _mm_or_ps(isOutside, _mm_cmplt_ps(_mm_add_ps(distance, reach), _mm_setzero_ps()));
+        }
+        U32 visibleMask = ~_mm_movemask_ps(isOutside) & 0xF;
+        for (U32 lane = 0; lane < 4; lane += 1)
+        {
+            visibleIndices[visibleLength] = first + lane;
+            visibleLength += (visibleMask >> lane) & 1;
+        }
+    }
+#else
+    for (U32 index = 0; index < paddedLength; index += 1)
+    {
+        bool isOutside = false;
+        for (const V4& plane : frustum.planes)
+        {
+            F32 distance = plane.x * volumes.centerX[index] + plane.y * volumes.centerY[index] + plane.z * volumes.centerZ[index] + plane.w;
+            F32 boxRadius = fabsf(plane.x) * volumes.extentX[index] + fabsf(plane.y) * volumes.extentY[index] + fabsf(plane.z) * volumes.extentZ[index];
+            isOutside = isOutside || distance + std::min(boxRadius, volumes.radii[index]) < 0;
+        }
+        visibleIndices[visibleLength] = index;
+        visibleLength += !isOutside;
+    }
+#endif
+
+    return visibleLength;
+}
@@ -1,7 +1,15 @@
+#pragma once
+
 #include "math.hpp"
 #include "types.hpp"
 
 struct Entity
 {
     M4 m = M4(1.0f);
+
+    // bounds of what the entity draws, in its own space: a box and the
+    // sphere around the same center, whichever is tighter culls
+    V3  boundsCenter;
+    V3  boundsExtent;  // half the box's size
+    F32 boundsRadius = 0;
 };
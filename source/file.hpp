@@ -0,0 +1,108 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <string>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Read-only view of a whole file mapped into memory. Parsers work directly on
+// [data, data + size) so loading never copies the file into a heap buffer.
+struct MappedFile
+{
+    const char* data = nullptr;
+    U64         size = 0;
+
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+    HANDLE mapping = NULL;
+#endif
+
+    MappedFile() {}
+
+    MappedFile(const std::string& path)
+    {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+        if (file == INVALID_HANDLE_VALUE) return;
+
+        LARGE_INTEGER fileSize;
+        GetFileSizeEx(file, &fileSize);
+        size = fileSize.QuadPart;
+
+        // an empty file cannot be mapped, but is still a valid (empty) view
+        if (size == 0)
+        {
+            data = "";
+            return;
+        }
+
+        mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (mapping == NULL) return;
+        data = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+        I32 descriptor = open(path.c_str(), O_RDONLY);
+        if (descriptor < 0) return;
+
+        struct stat status;
+        if (fstat(descriptor, &status) == 0)
+        {
+            size = status.st_size;
+            if (size == 0)
+            {
+                data = "";
+            }
+            else
+            {
+                void* view = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+                if (view != MAP_FAILED)
+                {
+                    madvise(view, size, MADV_SEQUENTIAL);
+                    data = (const char*)view;
+                }
+            }
+        }
+
+        // the mapping keeps its own reference to the file
+        close(descriptor);
+#endif
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile()
+    {
+        if (data != nullptr && size != 0)
+        {
+#ifdef _WIN32
+            UnmapViewOfFile(data);
+#else
+            munmap((void*)data, size);
+#endif
+        }
+#ifdef _WIN32
+        if (mapping != NULL) CloseHandle(mapping);
+        if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+#endif
+    }
+
+    bool isOpen()
+    {
+        return data != nullptr;
+    }
+
+    const char* end()
+    {
+        return data + size;
+    }
+};
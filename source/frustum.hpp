@@ -0,0 +1,59 @@
+#pragma once
+
+#include "math.hpp"
+#include "types.hpp"
+
+// The view frustum in whatever space a clip matrix maps from, after Gribb and
+// Hartmann, "Fast Extraction of Viewing Frustum Planes from the World-View-
+// Projection Matrix" (2001). Points are row vectors, V4(p, 1) * clip, so each
+// plane is the w column of clip plus or minus one of the others. Given
+// projection * view * model, the planes are in object space and nothing has
+// to be transformed to test against them.
+struct Frustum
+{
+    V4 planes[6];  // left, right, bottom, top, near, far; xyz unit, positive inside
+    V3 eye;        // the camera, where the x, y and w planes meet
+};
+
+Frustum getFrustum(M4 clip)
+{
+    V4 columnX = V4(clip.x.x, clip.y.x, clip.z.x, clip.w.x);
+    V4 columnY = V4(clip.x.y, clip.y.y, clip.z.y, clip.w.y);
+    V4 columnZ = V4(clip.x.z, clip.y.z, clip.z.z, clip.w.z);
+    V4 columnW = V4(clip.x.w, clip.y.w, clip.z.w, clip.w.w);
+
+    Frustum frustum;
+    frustum.planes[0] = columnW + columnX;
+    frustum.planes[1] = columnW - columnX;
+    frustum.planes[2] = columnW + columnY;
+    frustum.planes[3] = columnW - columnY;
+    frustum.planes[4] = columnW + columnZ;
+    frustum.planes[5] = columnW - columnZ;
+    for (V4& plane : frustum.planes)
+    {
+        // so that a plane's value at a point is the distance to it
+        F32 normalLength = length(V3(plane.x, plane.y, plane.z));
+        if (0 < normalLength) plane = plane / normalLength;
+    }
+
+    // clip x = y = w = 0 only at the eye of a perspective projection
+    V3  normalX = V3(columnX.x, columnX.y, columnX.z);
+    V3  normalY = V3(columnY.x, columnY.y, columnY.z);
+    V3  normalW = V3(columnW.x, columnW.y, columnW.z);
+    V3  crossYW = cross(normalY, normalW);
+    V3  crossWX = cross(normalW, normalX);
+    V3  crossXY = cross(normalX, normalY);
+    F32 determinant = dot(normalX, crossYW);
+    if (determinant != 0) frustum.eye = (crossYW * columnX.w + crossWX * columnY.w + crossXY * columnW.w) * (-1 / determinant);
+    return frustum;
+}
+
+// true if the sphere lies wholly outside one of the planes
+bool isSphereOutside(const Frustum& frustum, V3 center, F32 radius)
+{
+    for (const V4& plane : frustum.planes)
+    {
+        if (plane.x * center.x + plane.y * center.y + plane.z * center.z + plane.w < -radius) return true;
+    }
+    return false;
+}
@@ -0,0 +1,109 @@
+#pragma once
+
+#include "math.hpp"
+#include "mesh.hpp"
+#include "types.hpp"
+
+#include <glad/glad.h>
+
+#include <string.h>
+#include <vector>
+
+// Entities to draw this frame, grouped by the mesh they show, so every mesh
+// is one instanced draw call however many entities use it. The model
+// matrices of all groups are streamed into one buffer each frame, one after
+// the other. OpenGL 3.3 has no base instance, so each group's draw points the
+// per-instance attributes of the mesh's instancedVertexArray, enabled with a
+// divisor of one by load(), at its own part of the buffer instead.
+struct InstanceBatches
+{
+    struct Batch
+    {
+        WingedEdgeMesh* mesh = nullptr;
+        std::vector<M4> models;
+    };
+
+    // batches past batchesLength are spares kept for their capacity
+    std::vector<Batch> batches;
+    U32                batchesLength = 0;
+    U32                instanceBuffer = 0;
+    U32                instanceBufferCapacity = 0;  // matrices
+
+    void clear()
+    {
+        batchesLength = 0;
+    }
+
+    void add(WingedEdgeMesh& mesh, const M4& model)
+    {
+        // few meshes with many entities each, so a search from the newest batch is enough
+        for (U32 batchIndex = batchesLength; 0 < batchIndex; batchIndex -= 1)
+        {
+            Batch& batch = batches[batchIndex - 1];
+            if (batch.mesh == &mesh)
+            {
+                batch.models.push_back(model);
+                return;
+            }
+        }
+        if (batchesLength == batches.size()) batches.emplace_back();
+        Batch& batch = batches[batchesLength++];
+        batch.mesh = &mesh;
+        batch.models.clear();
+        batch.models.push_back(model);
+    }
+
+    U32 getInstancesLength() const
+    {
+        U32 instancesLength = 0;
+        for (U32 batchIndex = 0; batchIndex < batchesLength; batchIndex += 1)
+        {
+            instancesLength += batches[batchIndex].models.size();
+        }
+        return instancesLength;
+    }
+
+    // one upload and one draw call per mesh, with an instanced shader in use
+    void draw()
+    {
+        U32 instancesLength = getInstancesLength();
+        if (instancesLength == 0) return;
+
+        if (instanceBuffer == 0) glGenBuffers(1, &instanceBuffer);
+        glBindBuffer(GL_ARRAY_BUFFER, instanceBuffer);
+        if (instanceBufferCapacity < instancesLength)
+        {
+            instanceBufferCapacity = std::max(instancesLength, instanceBufferCapacity + instanceBufferCapacity / 2);
+            glBufferData(GL_ARRAY_BUFFER, (U64)instanceBufferCapacity * sizeof(M4), nullptr, GL_STREAM_DRAW);
+        }
+
+        // last frame's matrices may still be read, so the driver is told to hand over fresh memory
+        M4* mapped = (M4*)glMapBufferRange(GL_ARRAY_BUFFER, 0, (U64)instancesLength * sizeof(M4), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+        if (mapped == nullptr) return;
+        U32 firstInstance = 0;
+        for (U32 batchIndex = 0; batchIndex < batchesLength; batchIndex += 1)
+        {
+            const std::vector<M4>& models = batches[batchIndex].models;
+            memcpy(mapped + firstInstance, models.data(), models.size() * sizeof(M4));
+            firstInstance += models.size();
+        }
+        if (!glUnmapBuffer(GL_ARRAY_BUFFER)) return;  // contents lost, e.g. to a mode switch
+
+        firstInstance = 0;
+        for (U32 batchIndex = 0; batchIndex < batchesLength; batchIndex += 1)
+        {
+            Batch& batch = batches[batchIndex];
+            if (batch.mesh->vertexArray != 0)
+            {
+                glBindVertexArray(batch.mesh->instancedVertexArray);
+                for (U32 row = 0; row < 4; row += 1)
+                {
+                    glVertexAttribPointer(INSTANCE_MODEL_ATTRIBUTE + row, 4, GL_FLOAT, GL_FALSE, sizeof(M4), (void*)((U64)firstInstance * sizeof(M4) + row * sizeof(V4)));
+                }
+                batch.mesh->drawInstanced(batch.models.size());
+            }
+            firstInstance += batch.models.size();
+        }
+        glBindVertexArray(0);
+    }
+};
@@ -0,0 +1,111 @@
+#pragma once
+
+#include "mesh.hpp"
+#include "types.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Builds WingedEdgeMeshes on a background thread so switching models never
+// stalls the render loop. Only the most recent request matters: a newer
+// request cancels the one in flight, and the GL thread picks up the finished
+// mesh with poll().
+struct MeshLoader
+{
+    std::thread             thread;
+    std::mutex              mutex;
+    std::condition_variable condition;
+    std::atomic<bool>       isRunning;
+    std::atomic<U32>        generation;  // bumped by every request, older builds are stale
+
+    // guarded by mutex
+    std::string                     pendingPath;
+    bool                            hasPending = false;
+    std::unique_ptr<WingedEdgeMesh> result;
+    std::unique_ptr<WingedEdgeMesh> recycled;  // the mesh poll() replaced, built into next so its storage is reused
+    U32                             resultGeneration = 0;
+    U32                             shownGeneration = 0;
+
+    MeshLoader() : isRunning(true), generation(0)
+    {
+        thread = std::thread(&MeshLoader::run, this);
+    }
+
+    ~MeshLoader()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            isRunning = false;
+        }
+        condition.notify_one();
+        thread.join();
+    }
+
+    void request(std::string path)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            pendingPath = path;
+            hasPending = true;
+            generation += 1;
+        }
+        condition.notify_one();
+    }
+
+    bool isLoading()
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return shownGeneration != generation;
+    }
+
+    // Call on the GL thread. Moves the finished mesh into mesh and returns
+    // true, in which case the caller uploads it; otherwise mesh is untouched.
+    bool poll(WingedEdgeMesh& mesh)
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (result == nullptr || resultGeneration != generation) return false;
+
+        std::swap(mesh, *result);
+        recycled = std::move(result);
+        shownGeneration = resultGeneration;
+        return true;
+    }
+
+    void run()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            condition.wait(lock, [&] { return hasPending || !isRunning; });
+            if (!isRunning) return;
+
+            std::string path = pendingPath;
+            U32         requestGeneration = generation;
+            hasPending = false;
+
+            // an unclaimed result is stale by now and as good as a recycled mesh
+            std::unique_ptr<WingedEdgeMesh> loaded = std::move(recycled != nullptr ? recycled : result);
+            if (loaded == nullptr) loaded = std::make_unique<WingedEdgeMesh>();
+            lock.unlock();
+
+            bool isComplete = loaded->open(path, [&] { return generation != requestGeneration || !isRunning; });
+
+            lock.lock();
+            if (isComplete && generation == requestGeneration)
+            {
+                result = std::move(loaded);
+                resultGeneration = requestGeneration;
+            }
+            else
+            {
+                // a failed load is dropped and the current mesh stays up
+                if (generation == requestGeneration) shownGeneration = requestGeneration;
+                recycled = std::move(loaded);
+            }
+        }
+    }
+};
@@ -10,6 +10,9 @@
 #include <GLFW/glfw3.h>
 
 #include "camera.hpp"
+#include "culling.hpp"
+#include "instancing.hpp"
+#include "loader.hpp"
 #include "math.hpp"
 #include "mesh.hpp"
 #include "shader.hpp"
@@ -26,6 +29,14 @@
 const U32 SCR_WIDTH = 1366;
 const U32 SCR_HEIGHT = 768;
 const F32 DRAW_DISTANCE = 200.0f;
+const F32 ENTITY_SPACING = 2.5f;  // between the copies of the mesh in the scene grid
+
+// the uniforms set every frame, hashed while compiling
+constexpr UniformName MODEL_UNIFORM = "model";
+constexpr UniformName SHOW_WIREFRAME_UNIFORM = "showWireframe";
+constexpr UniformName IS_SMOOTH_UNIFORM = "isSmooth";
+constexpr UniformName BOUNDS_MIN_UNIFORM = "boundsMin";
+constexpr UniformName BOUNDS_SIZE_UNIFORM = "boundsSize";
 V3        color = V3(0.7f, 0.3f, 0.4f);
 
 struct State
@@ -36,8 +47,23 @@ struct State
     V3   translation = V3(0, 0, 0);
     bool showWireframe = true;
     bool isSmooth = false;
+    bool isIndexed = false;
     bool isFirstFrame = true;
     I32  selectedModelIndex = 4;
+    I32  normalWeighting = AREA_WEIGHTING;
+    bool isDeforming = false;
+    I32  subdivisionLevels = 1;
+    bool isLimit = false;
+    bool isOverdrawOrdered = false;
+    F32  simplifyRatio = 0.25f;
+    bool hasLevels = false;
+    I32  levelOfDetail = 0;  // 0 is the mesh itself, then the levels, coarsest last
+    bool isMeshletCulled = false;
+    I32  entitiesLength = 0;  // copies of the mesh on a grid, 0 for just the mesh
+    bool isInstanced = false;
+    I32  refinementCriterion = 0;
+    F32  maxCurvature = 10;    // degrees between neighbouring face normals
+    F32  maxEdgeLength = 20;  // pixels
 };
 
 static State state = State();
@@ -137,6 +163,7 @@ I32 main()
         std::cout << "Failed to initialize GLAD" << std::endl;
         return -1;
     }
+    loadProgramBinaryCache((GLADloadproc)glfwGetProcAddress);
 
     // configure global opengl state
     glEnable(GL_DEPTH_TEST);
@@ -156,9 +183,44 @@ I32 main()
     Shader shader = Shader("shaders/shader.vert", "shaders/shader.frag");
     shader.use();
     shader.setV3("color", color);
+    Shader indexedShader = Shader("shaders/indexed.vert", "shaders/shader.frag", "shaders/indexed.geom");
+    indexedShader.use();
+    indexedShader.setV3("color", color);
+    Shader instancedShader = Shader("shaders/instanced.vert", "shaders/shader.frag");
+    instancedShader.use();
+    instancedShader.setV3("color", color);
+    Shader indexedInstancedShader = Shader("shaders/indexedinstanced.vert", "shaders/shader.frag", "shaders/indexed.geom");
+    indexedInstancedShader.use();
+    indexedInstancedShader.setV3("color", color);
+
+    // startup cost of the programs: cold compiles them, warm loads their binaries
+    F64 shadersMilliseconds = 0;
+    U32 cachedShadersLength = 0;
+    for (Shader *program : {&shader, &indexedShader, &instancedShader, &indexedInstancedShader})
+    {
+        shadersMilliseconds += program->buildMilliseconds;
+        cachedShadersLength += program->isFromCache;
+    }
+    OUT("shaders ready in " << shadersMilliseconds << " ms, " << cachedShadersLength << " of 4 from the binary cache");
+
+    FrameUniformBuffer frameUniformBuffer;
 
     // load mesh
     WingedEdgeMesh mesh;
+    MeshLoader     loader;
+    std::vector<V3> deformedPositions;
+
+    // kept across rebuilds so every level reuses its buffers
+    const std::vector<F32>      levelRatios = {0.5f, 0.25f, 0.125f, 0.0625f};
+    std::vector<WingedEdgeMesh> levels;
+
+    // the scene: entities are culled by their bounds before any of them is drawn
+    std::vector<Entity> entities;
+    BoundingVolumes     entityBounds;
+    std::vector<U32>    visibleEntities;
+    U32                 visibleEntitiesLength = 0;
+    F32                 cullingMilliseconds = 0;
+    InstanceBatches     instanceBatches;
 
     // imgui: state
     ImVec4 clear_color = ImVec4(0.45f, 0.55f, 0.60f, 1.00f);
@@ -197,9 +259,31 @@ I32 main()
         ImGui::SliderFloat("translate z", &state.translation.z, -5.0f, 5.0f);
 
         ImGui::Checkbox("Show Wireframe", &state.showWireframe);
-        if (ImGui::Checkbox("Smooth", &state.isSmooth))
+        // only the normals differ, and indexed the geometry shader picks them without any upload
+        if (ImGui::Checkbox("Smooth", &state.isSmooth) && !state.isIndexed)
+        {
+            mesh.loadNormals(state.isSmooth);
+            if (state.hasLevels)
+            {
+                for (WingedEdgeMesh &level : levels) level.loadNormals(state.isSmooth);
+            }
+        }
+
+        // indexed, every vertex is uploaded once and the geometry shader adds the wireframe barycentrics
+        if (ImGui::Checkbox("indexed", &state.isIndexed))
         {
-            mesh.load(state.isSmooth);
+            mesh.load(state.isSmooth, state.isIndexed);
+            if (state.hasLevels)
+            {
+                for (WingedEdgeMesh &level : levels) level.load(state.isSmooth, state.isIndexed);
+            }
+        }
+
+        const char *weightings[] = {"uniform", "area", "angle"};
+        if (ImGui::Combo("normals", &state.normalWeighting, weightings, IM_ARRAYSIZE(weightings)))
+        {
+            mesh.computeNormals((NormalWeighting)state.normalWeighting);
+            mesh.loadNormals(state.isSmooth);
         }
 
         // Simplified one-liner Combo() API, using values packed in a single constant string
@@ -215,16 +299,138 @@ I32 main()
 
         if (ImGui::Combo("model", &state.selectedModelIndex, models, IM_ARRAYSIZE(models)) || state.isFirstFrame)
         {
-            mesh = WingedEdgeMesh("assets/" + std::string(models[state.selectedModelIndex]));
-            mesh.load(state.isSmooth);
+            loader.request("assets/" + std::string(models[state.selectedModelIndex]));
         }
 
+        // keep drawing the current mesh until the new one is built
+        if (loader.poll(mesh))
+        {
+            state.isDeforming = false;
+            state.hasLevels = false;
+            state.levelOfDetail = 0;
+            // the loader does not know the selected weighting, nor did whoever wrote the cache
+            if (mesh.normalWeighting != state.normalWeighting) mesh.computeNormals((NormalWeighting)state.normalWeighting);
+            if (mesh.isOverdrawOrdered != state.isOverdrawOrdered)
+            {
+                mesh.isOverdrawOrdered = state.isOverdrawOrdered;
+                mesh.optimizeOrder();
+            }
+            mesh.load(state.isSmooth, state.isIndexed);
+        }
+        if (loader.isLoading())
+        {
+            ImGui::Text("loading %s...", models[state.selectedModelIndex]);
+        }
+
+        // several levels at once are refined without shading or uploading the ones in between
+        ImGui::SliderInt("levels", &state.subdivisionLevels, 1, 4);
+        ImGui::Checkbox("limit surface", &state.isLimit);
         if (ImGui::Button("subdivide"))
         {
-            mesh.subdivide();
-            mesh.load(state.isSmooth);
+            mesh.subdivide(state.subdivisionLevels);
+            if (state.isLimit) mesh.projectToLimit();
+            mesh.load(state.isSmooth, state.isIndexed);
+        }
+
+        // adaptive refinement only splits where the surface bends or where the camera sees long edges
+        const char *criteria[] = {"curvature", "screen edge length"};
+        ImGui::Combo("refine by", &state.refinementCriterion, criteria, IM_ARRAYSIZE(criteria));
+        if (state.refinementCriterion == 0)
+        {
+            ImGui::SliderFloat("max angle", &state.maxCurvature, 1.0f, 45.0f);
+        }
+        else
+        {
+            ImGui::SliderFloat("max edge pixels", &state.maxEdgeLength, 2.0f, 100.0f);
+        }
+        if (ImGui::Button("refine adaptively"))
+        {
+            if (state.refinementCriterion == 0)
+            {
+                F32 maxCurvature = radians(state.maxCurvature);
+                mesh.refineAdaptive([&](U32 face) { return maxCurvature < mesh.getFaceCurvature(face); });
+            }
+            else
+            {
+                M4 view = camera.getViewMatrix();
+                M4 projection = perspective(radians(camera.zoom), (F32)SCR_WIDTH / (F32)SCR_HEIGHT, 0.1f, DRAW_DISTANCE);
+                M4 clipFromObject = projection * view * mesh.m;
+                mesh.refineAdaptive([&](U32 face) { return state.maxEdgeLength < mesh.getProjectedEdgeLength(face, clipFromObject, SCR_WIDTH, SCR_HEIGHT); });
+            }
+            mesh.load(state.isSmooth, state.isIndexed);
         }
+        ImGui::Text("%zu triangles", mesh.faceNormals.size());
 
+        // quadric edge collapses, in place or into a chain of coarser copies drawn instead of the mesh
+        ImGui::SliderFloat("keep faces", &state.simplifyRatio, 0.01f, 1.0f);
+        if (ImGui::Button("simplify"))
+        {
+            mesh.simplify(mesh.faceNormals.size() * state.simplifyRatio);
+            mesh.load(state.isSmooth, state.isIndexed);
+            state.isDeforming = false;
+        }
+        ImGui::SameLine();
+        if (ImGui::Button("create levels of detail"))
+        {
+            mesh.createLevelsOfDetail(levelRatios, levels);
+            for (WingedEdgeMesh &level : levels) level.load(state.isSmooth, state.isIndexed);
+            state.hasLevels = true;
+        }
+        if (state.hasLevels)
+        {
+            ImGui::SliderInt("level of detail", &state.levelOfDetail, 0, levels.size());
+        }
+        WingedEdgeMesh &drawnMesh = state.hasLevels && 0 < state.levelOfDetail ? levels[state.levelOfDetail - 1] : mesh;
+        if (state.hasLevels)
+        {
+            ImGui::Text("%zu triangles shown", drawnMesh.faceNormals.size());
+        }
+
+        // meshlets outside the view or facing away are not drawn, which is only invisible on closed meshes
+        ImGui::Checkbox("cull meshlets", &state.isMeshletCulled);
+        if (state.isMeshletCulled)
+        {
+            ImGui::Text("%u of %zu meshlets, %u triangles drawn", drawnMesh.visibleMeshletsLength, drawnMesh.meshlets.size(), drawnMesh.visibleFacesLength);
+        }
+
+        ImGui::SliderInt("entities", &state.entitiesLength, 0, 10000);
+        if (0 < state.entitiesLength)
+        {
+            ImGui::Text("%u of %d entities visible, culled in %.3f ms", visibleEntitiesLength, state.entitiesLength, cullingMilliseconds);
+            // one draw call for all the visible copies, which then skip meshlet culling
+            ImGui::Checkbox("instanced", &state.isInstanced);
+        }
+
+        // faces are reordered for the vertex cache on every load and subdivision, measured with a simulated FIFO
+        if (ImGui::Checkbox("order for overdraw", &state.isOverdrawOrdered))
+        {
+            mesh.isOverdrawOrdered = state.isOverdrawOrdered;
+            mesh.optimizeOrder();
+            mesh.load(state.isSmooth, state.isIndexed);
+        }
+        if (0 < mesh.cacheStatisticsBefore.acmr)
+        {
+            ImGui::Text("ACMR %.3f -> %.3f, ATVR %.3f -> %.3f", mesh.cacheStatisticsBefore.acmr, mesh.cacheStatisticsAfter.acmr, mesh.cacheStatisticsBefore.atvr, mesh.cacheStatisticsAfter.atvr);
+        }
+
+        // the connectivity is refined once, after that every frame only moves vertices
+        if (ImGui::Checkbox("deform subdivided", &state.isDeforming) && state.isDeforming)
+        {
+            mesh.createStencilTables(2);
+        }
+        if (state.isDeforming)
+        {
+            deformedPositions.resize(mesh.controlPositions.size());
+            for (U32 vertexIndex = 0; vertexIndex < deformedPositions.size(); vertexIndex += 1)
+            {
+                V3 position = mesh.controlPositions[vertexIndex];
+                deformedPositions[vertexIndex] = position + V3(0, 0.05f * sin(4 * t.current + 8 * position.x), 0);
+            }
+            state.isDeforming = mesh.evaluateStencilTables(deformedPositions.data());
+            if (state.isDeforming) mesh.load(state.isSmooth, state.isIndexed);
+        }
+
+        ImGui::Text("shaders ready in %.1f ms, %u of 4 from the binary cache", shadersMilliseconds, cachedShadersLength);
         ImGui::Text("Application average %.3f ms/frame (%.1f FPS)", 1000.0f / ImGui::GetIO().Framerate, ImGui::GetIO().Framerate);
         ImGui::End();
 
@@ -233,22 +439,78 @@ I32 main()
         if (1 < state.rotation) state.rotation = 0;
         mesh.m = rotationY(state.rotation * 2 * PI);
         mesh.m.translate(state.translation);
+        drawnMesh.m = mesh.m;
 
-        shader.setM4("model", mesh.m);
-
+        // the camera and light once for every program
         camera.position = cameraPosition * state.zoom;
         M4 view = camera.getViewMatrix();
-        shader.setM4("view", view);
-
         M4 projection = perspective(radians(camera.zoom), (F32)SCR_WIDTH / (F32)SCR_HEIGHT, 0.1f, DRAW_DISTANCE);
-        shader.setM4("projection", projection);
-
-        V3 light = normalize(V3(0.2f, -1.0f, -0.4f));
-        shader.setV3("light", light);
-
-        shader.setBool("showWireframe", state.showWireframe);
-
-        mesh.draw();
+        frameUniformBuffer.update({view, projection, V4(normalize(V3(0.2f, -1.0f, -0.4f)), 0)});
+
+        bool    isInstancing = 0 < state.entitiesLength && state.isInstanced;
+        Shader &activeShader = isInstancing ? (state.isIndexed ? indexedInstancedShader : instancedShader) : (state.isIndexed ? indexedShader : shader);
+        activeShader.use();
+
+        activeShader.setBool(SHOW_WIREFRAME_UNIFORM, state.showWireframe);
+        activeShader.setBool(IS_SMOOTH_UNIFORM, state.isSmooth);
+        activeShader.setV3(BOUNDS_MIN_UNIFORM, drawnMesh.boundsMin);
+        activeShader.setV3(BOUNDS_SIZE_UNIFORM, drawnMesh.boundsSize);
+
+        auto drawEntity = [&](M4 model) {
+            activeShader.setM4(MODEL_UNIFORM, model);
+            if (state.isMeshletCulled)
+            {
+                drawnMesh.drawMeshlets(projection * view * model);
+            }
+            else
+            {
+                drawnMesh.draw();
+            }
+        };
+        if (state.entitiesLength == 0)
+        {
+            drawEntity(drawnMesh.m);
+        }
+        else
+        {
+            U32 entitiesLength = state.entitiesLength;
+            U32 side = ceil(sqrt((F32)entitiesLength));
+            entities.resize(entitiesLength);
+            entityBounds.resize(entitiesLength);
+            visibleEntities.resize(entityBounds.radii.size());
+            for (U32 entityIndex = 0; entityIndex < entitiesLength; entityIndex += 1)
+            {
+                Entity &entity = entities[entityIndex];
+                V3      gridPosition = V3(entityIndex % side - (side - 1) * 0.5f, 0, entityIndex / side - (side - 1) * 0.5f);
+                entity.m = drawnMesh.m;
+                entity.m.translate(state.translation + gridPosition * ENTITY_SPACING);
+                entity.boundsCenter = drawnMesh.boundsCenter;
+                entity.boundsExtent = drawnMesh.boundsExtent;
+                entity.boundsRadius = drawnMesh.boundsRadius;
+                entityBounds.set(entityIndex, entity);
+            }
+
+            auto cullingStart = std::chrono::steady_clock::now();
+            visibleEntitiesLength = cullBoundingVolumes(getFrustum(projection * view), entityBounds, visibleEntities.data());
+            cullingMilliseconds = std::chrono::duration<F32, std::milli>(std::chrono::steady_clock::now() - cullingStart).count();
+
+            if (isInstancing)
+            {
+                instanceBatches.clear();
+                for (U32 visibleIndex = 0; visibleIndex < visibleEntitiesLength; visibleIndex += 1)
+                {
+                    instanceBatches.add(drawnMesh, entities[visibleEntities[visibleIndex]].m);
+                }
+                instanceBatches.draw();
+            }
+            else
+            {
+                for (U32 visibleIndex = 0; visibleIndex < visibleEntitiesLength; visibleIndex += 1)
+                {
+                    drawEntity(entities[visibleEntities[visibleIndex]].m);
+                }
+            }
+        }
 
         // imgui: render
         ImGui::Render();
@@ -1,8 +1,17 @@
 #pragma once
 
+#include "arena.hpp"
+#include "cache.hpp"
 #include "entity.hpp"
+#include "file.hpp"
 #include "math.hpp"
+#include "meshlet.hpp"
+#include "obj.hpp"
+#include "parallel.hpp"
+#include "quadric.hpp"
+#include "stencil.hpp"
 #include "types.hpp"
+#include "vertexcache.hpp"
 
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
@@ -13,128 +22,270 @@
 #include <glm/gtc/matrix_transform.hpp>
 
 #include <math.h>
+#include <stdio.h>
+#include <algorithm>
+#include <array>
 #include <fstream>
 #include <iostream>
 #include <random>
-#include <sstream>
 #include <string>
-#include <unordered_map>
 #include <vector>
 
-struct Face;
-struct Vertex;
+struct Vertex
+{
+    Vertex() {}
+    Vertex(V3 position) : position(position) {}
+
+    V3 position;
+    V3 barycentric;
+    V3 normal;
+};
+
+// the first of the four attributes the instanced shaders read a model matrix from
+const U32 INSTANCE_MODEL_ATTRIBUTE = 3;
+
+// Half-edges are numbered so that edge 3 * face + k runs from corner k of the
+// face to corner k + 1; the face, next and previous edges are implied by the
+// number and the start vertex is indices[edge].
+U32 getNextEdge(U32 edge)
+{
+    return edge % 3 == 2 ? edge - 2 : edge + 1;
+}
+
+U32 getPreviousEdge(U32 edge)
+{
+    return edge % 3 == 0 ? edge + 2 : edge - 1;
+}
+
+// The two edges a subdivided edge becomes, from its start to the odd vertex
+// and from the odd vertex to its end, numbered as WingedEdgeMesh::refine()
+// lays out the four faces.
+U32 getStartHalfEdge(U32 edge)
+{
+    return edge / 3 * 12 + edge % 3 * 3;
+}
+
+U32 getEndHalfEdge(U32 edge)
+{
+    const U32 END_HALVES[] = {5, 8, 2};
+    return edge / 3 * 12 + END_HALVES[edge % 3];
+}
+
+// Loop's weight for each neighbour of an inner vertex with degree neighbours.
+F32 computeLoopWeight(U32 degree)
+{
+    F32 x = (3.0f / 8.0f) + (1.0f / 4.0f) * cos((2.0f * PI) / degree);
+    return (1.0f / degree) * ((5.0f / 8.0f) - (x * x));
+}
 
-struct Edge
+// computeLoopWeight() looked up for the degrees that come up in practice
+F32 getLoopWeight(U32 degree)
+{
+    static const std::array<F32, 32> weights = [] {
+        std::array<F32, 32> table = {};
+        for (U32 tableDegree = 1; tableDegree < table.size(); tableDegree += 1)
+        {
+            table[tableDegree] = computeLoopWeight(tableDegree);
+        }
+        return table;
+    }();
+    return degree < weights.size() ? weights[degree] : computeLoopWeight(degree);
+}
+
+// Weights of the tangent across an open boundary at a boundary vertex with
+// k faces, for the vertex itself and then its neighbours r0 to rk in order.
+// Along the boundary the limit is the cubic B-spline, with tangent r0 - rk,
+// but the published masks for the other direction (Hoppe et al. 1994) assume
+// a modified rule for the inner edges that refine() does not use. So the mask
+// is the left eigenvector of refine()'s own one-ring subdivision matrix for
+// the largest eigenvalue below 1 that is symmetric in r0 to rk, found by
+// power iteration.
+void computeBoundaryTangentWeights(U32 k, std::vector<F32>& weights)
 {
-    Vertex* start;
-    Vertex* end;
-    Face*   face;
-    Edge*   next;
-    Edge*   previous;
-    Edge*   symmetric;
+    // rows are refined positions of the vertex, r0, ..., rk in terms of the same unrefined ones
+    U32              size = k + 2;
+    std::vector<F64> matrix(size * size, 0);
+    auto             at = [&](U32 row, U32 column) -> F64& { return matrix[row * size + column]; };
+    at(0, 0) = 3.0 / 4.0, at(0, 1) = 1.0 / 8.0, at(0, k + 1) = 1.0 / 8.0;
+    at(1, 0) = 1.0 / 2.0, at(1, 1) = 1.0 / 2.0;
+    at(k + 1, 0) = 1.0 / 2.0, at(k + 1, k + 1) = 1.0 / 2.0;
+    for (U32 i = 1; i < k; i += 1)
+    {
+        at(i + 1, 0) = 3.0 / 8.0, at(i + 1, i + 1) = 3.0 / 8.0, at(i + 1, i) = 1.0 / 8.0, at(i + 1, i + 2) = 1.0 / 8.0;
+    }
+
+    // limit mask (4 v + r0 + rk) / 6, the eigenvalue 1 part removed every step
+    std::vector<F64> limitMask(size, 0);
+    limitMask[0] = 4.0 / 6.0, limitMask[1] = 1.0 / 6.0, limitMask[k + 1] = 1.0 / 6.0;
+
+    std::vector<F64> mask(size), product(size);
+    for (U32 i = 0; i <= k; i += 1)
+    {
+        mask[i + 1] = 1 + i * (k - i);
+    }
+    for (U32 iteration = 0; iteration < 200; iteration += 1)
+    {
+        // rounding would otherwise grow the along tangent back in when it dominates
+        for (U32 i = 0; i <= k / 2; i += 1)
+        {
+            mask[i + 1] = mask[k - i + 1] = (mask[i + 1] + mask[k - i + 1]) / 2;
+        }
+
+        F64 sum = 0;
+        for (F64 weight : mask) sum += weight;
+        F64 largest = 0;
+        for (U32 column = 0; column < size; column += 1)
+        {
+            mask[column] -= sum * limitMask[column];
+            largest = std::max(largest, fabs(mask[column]));
+        }
+        for (U32 column = 0; column < size; column += 1)
+        {
+            product[column] = 0;
+            for (U32 row = 0; row < size; row += 1)
+            {
+                product[column] += mask[row] / largest * at(row, column);
+            }
+        }
+        std::swap(mask, product);
+    }
+
+    F64 sum = 0;
+    for (F64 weight : mask) sum += weight;
+    weights.resize(size);
+    for (U32 column = 0; column < size; column += 1)
+    {
+        weights[column] = mask[column] - sum * limitMask[column];
+    }
+}
+
+// computeBoundaryTangentWeights() looked up for the face counts that come up
+// in practice, and computed on each call beyond them
+const F32* getBoundaryTangentWeights(U32 faces)
+{
+    static const std::vector<std::vector<F32>> table = [] {
+        std::vector<std::vector<F32>> weights(33);
+        for (U32 k = 1; k < weights.size(); k += 1)
+        {
+            computeBoundaryTangentWeights(k, weights[k]);
+        }
+        return weights;
+    }();
+    if (faces < table.size()) return table[faces].data();
+
+    thread_local std::vector<F32> weights;
+    computeBoundaryTangentWeights(faces, weights);
+    return weights.data();
+}
+
+// Half-edge (start, end) packed into one integer, so that sorting brings equal
+// edges together and the opposite edge is found by swapping the halves.
+struct EdgeKey
+{
+    U64 key;
+    U32 edge;
+
+    EdgeKey() {}
+    EdgeKey(U32 start, U32 end, U32 edge) : key((U64)start << 32 | end), edge(edge) {}
+
+    U64 reversed()
+    {
+        return key << 32 | key >> 32;
+    }
+
+    bool operator<(const EdgeKey& other) const
+    {
+        return key < other.key;
+    }
 };
 
-struct Face
+// How much a face counts towards the normal of each of its corners.
+enum NormalWeighting
 {
-    Edge* edge;  // always the counter-clockwise egde
-    V3    normal;
+    UNIFORM_WEIGHTING,  // the plain mean of the face normals around the vertex
+    AREA_WEIGHTING,     // large faces count more, small slivers hardly at all
+    ANGLE_WEIGHTING     // by the corner angle, so splitting a face does not change the result
 };
 
-struct Vertex
+// Position as a fraction of the mesh bounds on each axis, 0 to 65535, read
+// by the shaders as normalized unsigned shorts. w only pads it to 8 bytes.
+struct PackedPosition
 {
-    Vertex() {}
-    Vertex(V3 position) : position(position) {}
+    U16 x, y, z, w;
+};
 
-    V3    position;
-    V3    barycentric;
-    V3    normal;
-    Edge* edge;  // always the counter-clockwise egde
+// Unit normal folded onto the octahedron |x| + |y| + |z| = 1 and that
+// flattened onto the square [-1, 1]^2, as normalized signed shorts.
+struct PackedNormal
+{
+    I16 x, y;
 };
 
+PackedNormal packNormal(V3 normal)
+{
+    F32 sum = fabs(normal.x) + fabs(normal.y) + fabs(normal.z);
+    if (sum == 0) return {0, 0};
+
+    F32 x = normal.x / sum;
+    F32 y = normal.y / sum;
+    if (normal.z < 0)
+    {
+        // the lower half folds out over the corners
+        F32 foldedX = (1 - fabs(y)) * (x < 0 ? -1 : 1);
+        y = (1 - fabs(x)) * (y < 0 ? -1 : 1);
+        x = foldedX;
+    }
+    return {(I16)lroundf(x * 32767), (I16)lroundf(y * 32767)};
+}
+
 struct Mesh : Entity
 {
     std::vector<Vertex> vertices;
     std::vector<U32>    indices;
-    U32                 vertexArray, vertexBuffer, elementBuffer;
+    U32                 vertexArray = 0, vertexBuffer = 0, elementBuffer = 0;
+
+    ObjData objData;  // parser output, kept so that reloading reuses its capacity
 
     Mesh(){};
 
     Mesh(std::string path)
     {
-        U32                vIndex = 0, vnIndex = 0;
-        std::ifstream      file = std::ifstream(path);
-        std::istringstream stream;
-        std::string        line;
-        std::string        valueString;
-        std::string        token;
-        F32                value;
-        F32                max = 0;
-        V3_T<U32>          indexVector;
-        if (file.is_open())
+        MappedFile file = MappedFile(path);
+        if (!file.isOpen())
         {
-            while (getline(file, line))
-            {
-                stream = std::istringstream(line);
-                stream >> token;
-
-                if (token == "v")
-                {
-                    vertices.push_back(Vertex());
-
-                    stream >> valueString;
-                    value = std::stof(valueString);
-                    vertices[vIndex].position.x = value;
-                    if (max < value) max = value;
-
-                    stream >> valueString;
-                    value = std::stof(valueString);
-                    vertices[vIndex].position.y = value;
-                    if (max < value) max = value;
-
-                    stream >> valueString;
-                    value = std::stof(valueString);
-                    vertices[vIndex].position.z = value;
-                    if (max < value) max = value;
-
-                    vIndex++;
-                }
-                else if (token == "f")
-                {
-                    stream >> valueString;
-                    indexVector = processIndices(valueString);
-                    indices.push_back(indexVector.x - 1);
+            std::cout << "file not read." << std::endl;
+            return;
+        }
+        parse(file, path);
+    }
 
-                    stream >> valueString;
-                    indexVector = processIndices(valueString);
-                    indices.push_back(indexVector.x - 1);
+    void parse(MappedFile& file, const std::string& path)
+    {
+        // large files are split into line-aligned chunks parsed on every core
+        U32 threadCount = std::min<U64>(getThreadCount(), file.size / OBJ_CHUNK_SIZE + 1);
 
-                    stream >> valueString;
-                    indexVector = processIndices(valueString);
-                    indices.push_back(indexVector.x - 1);
-                }
-            }
-            file.close();
+        objData.clear();
+        if (threadCount == 1)
+        {
+            parseObj(file.data, file.end(), objData);
         }
         else
         {
-            std::cout << "file not read." << std::endl;
+            parseObjParallel(file.data, file.end(), objData, threadCount);
         }
+        U32 droppedFaces = dropInvalidFaces(objData);
+        if (droppedFaces != 0) std::cout << path << ": dropped " << droppedFaces << " faces with out of range vertex indices" << std::endl;
+
+        std::swap(indices, objData.indices);
 
         // scale vertices
+        vertices.resize(objData.positions.size());
         for (U32 vertexIndex = 0; vertexIndex < vertices.size(); vertexIndex++)
         {
-            vertices[vertexIndex].position = vertices[vertexIndex].position * (1 / max);
+            vertices[vertexIndex].position = objData.positions[vertexIndex] * (1 / objData.max);
         }
     }
 
-    static V3_T<U32> processIndices(std::string string)
-    {
-        U32 dividerIndex1 = string.find("/");
-        U32 dividerIndex2 = string.rfind("/");
-
-        return V3_T<U32>(std::stoi(string.substr(0, dividerIndex1)), std::stoi(string.substr(dividerIndex1 + 1, dividerIndex2)), std::stoi(string.substr(dividerIndex2 + 1)));
-    }
-
     void draw()
     {
         glBindVertexArray(vertexArray);
@@ -158,7 +309,7 @@ struct Mesh : Entity
         // Element Buffer Object
         glGenBuffers(1, &elementBuffer);
         glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
-        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(U32), &indices[0], GL_STATIC_DRAW);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(U32), indices.data(), GL_STATIC_DRAW);
 
         // Vertex Positions
         glEnableVertexAttribArray(0);
@@ -176,306 +327,1753 @@ struct Mesh : Entity
 
 struct WingedEdgeMesh : Mesh
 {
-    U32 facesLength;
-    U32 edgesLength;
-    U32 orderedVerticesLength;
-
-    Face*   faces;
-    Edge*   edges;
-    Vertex* orderedVertices;
+    std::vector<U32> symmetricEdges;  // per half-edge, NO_INDEX on an open boundary
+    std::vector<U32> vertexEdges;     // per vertex, an edge leaving it, NO_INDEX if unused
+    std::vector<V3>  faceNormals;
+
+    NormalWeighting normalWeighting = AREA_WEIGHTING;  // what the vertex normals were computed with
+
+    // storage for every rebuild: the arena holds scratch that is dead once a
+    // build returns, and refine() and optimizeOrder() write the new mesh into
+    // the spare arrays and swap them with the current ones
+    Arena               arena;
+    std::vector<Vertex> spareVertices;
+    std::vector<U32>    spareIndices;
+    std::vector<U32>    spareSymmetricEdges;
+    std::vector<V3>     spareFaceNormals;
+
+    // set by createStencilTables(): the vertices before subdividing and how
+    // each level of subdivision weighs the vertices of the level before
+    std::vector<V3>           controlPositions;
+    std::vector<StencilTable> stencilTables;
+
+    // optimizeOrder() also sorts face clusters for overdraw, off since nothing culls back faces
+    bool isOverdrawOrdered = false;
+
+    // vertex cache behaviour of the faces before and after the last optimizeOrder()
+    VertexCacheStatistics cacheStatisticsBefore, cacheStatisticsAfter;
+
+    // face ranges from optimizeOrder(), bounds from the positions of the last load()
+    std::vector<Meshlet> meshlets;
+
+    // what drawMeshlets() drew last, and the ranges it passed to the driver
+    U32                      visibleMeshletsLength = 0, visibleFacesLength = 0;
+    std::vector<GLint>       drawFirsts;
+    std::vector<GLsizei>     drawCounts;
+    std::vector<const void*> drawOffsets;
+
+    U32    instancedVertexArray = 0;      // the same buffers plus a model matrix per instance, see InstanceBatches
+    U32    orderedVerticesLength = 0;     // corners drawn
+    U32    vertexBufferCapacity = 0;      // vertices each attribute range of vertexBuffer has room for
+    U64    elementBufferCapacity = 0;     // bytes
+    GLenum indexType = GL_UNSIGNED_INT;   // of the element buffer
+    bool   isLoadedIndexed = false;       // which layout load() last uploaded
+    V3     boundsMin, boundsSize;         // the uploaded positions are fractions of these
 
     WingedEdgeMesh() : Mesh() {}
 
-    WingedEdgeMesh(std::string path) : Mesh(path)
+    WingedEdgeMesh(std::string path) : Mesh()
+    {
+        open(path, [] { return false; });
+    }
+
+    // Loads path, polling isCancelled() between stages. Returns false if the
+    // file could not be read or the load was abandoned, leaving the mesh
+    // incomplete.
+    template <typename F>
+    bool open(std::string path, F isCancelled)
     {
+        MappedFile file = MappedFile(path);
+        if (!file.isOpen())
+        {
+            std::cout << "file not read." << std::endl;
+            return false;
+        }
+        controlPositions.clear();
+        stencilTables.clear();
+
+        // the cache is reused until the OBJ it was built from changes
+        U64         sourceHash = hashBytes(file.data, file.size);
+        std::string cachePath = getMeshCachePath(path);
+        if (readCache(cachePath, sourceHash)) return true;
+        if (isCancelled()) return false;
+
+        parse(file, path);
+        if (isCancelled()) return false;
+
         createWingedEdgeMesh();
+        optimizeOrder();
+        writeCache(cachePath, sourceHash);
+        return true;
+    }
+
+    bool readCache(const std::string& path, U64 sourceHash)
+    {
+        MappedFile file = MappedFile(path);
+        if (!file.isOpen() || file.size < sizeof(MeshCacheHeader)) return false;
+
+        MeshCacheHeader header;
+        memcpy(&header, file.data, sizeof(MeshCacheHeader));
+        if (header.magic != MESH_CACHE_MAGIC || header.version != MESH_CACHE_VERSION || header.sourceHash != sourceHash) return false;
+        if (header.indexCount != header.faceCount * 3 || ANGLE_WEIGHTING < header.normalWeighting) return false;
+
+        U64 size = sizeof(MeshCacheHeader) +
+                   (U64)header.vertexCount * (sizeof(CachedVertex) + sizeof(U32)) +
+                   (U64)header.faceCount * (3 * sizeof(U32) + 3 * sizeof(U32) + sizeof(V3)) +
+                   (U64)header.meshletCount * sizeof(CachedMeshlet);
+        if (file.size != size) return false;
+
+        auto cachedVertices = (const CachedVertex*)(file.data + sizeof(MeshCacheHeader));
+        auto cachedVertexEdges = (const U32*)(cachedVertices + header.vertexCount);
+        auto cachedIndices = cachedVertexEdges + header.vertexCount;
+        auto cachedSymmetricEdges = cachedIndices + header.indexCount;
+        auto cachedFaceNormals = (const V3*)(cachedSymmetricEdges + header.indexCount);
+        auto cachedMeshlets = (const CachedMeshlet*)(cachedFaceNormals + header.faceCount);
+        if (!isCacheValid(header, cachedVertexEdges, cachedIndices, cachedSymmetricEdges, cachedMeshlets))
+        {
+            std::cout << "mesh cache damaged: " << path << std::endl;
+            return false;
+        }
+
+        // every reference is already an index, so the arrays are used as they are
+        vertices.resize(header.vertexCount);
+        for (U32 vertexIndex = 0; vertexIndex < header.vertexCount; vertexIndex += 1)
+        {
+            vertices[vertexIndex].position = cachedVertices[vertexIndex].position;
+            vertices[vertexIndex].normal = cachedVertices[vertexIndex].normal;
+        }
+        vertexEdges.assign(cachedVertexEdges, cachedVertexEdges + header.vertexCount);
+        indices.assign(cachedIndices, cachedIndices + header.indexCount);
+        symmetricEdges.assign(cachedSymmetricEdges, cachedSymmetricEdges + header.indexCount);
+        faceNormals.assign(cachedFaceNormals, cachedFaceNormals + header.faceCount);
+        meshlets.resize(header.meshletCount);
+        for (U32 meshletIndex = 0; meshletIndex < header.meshletCount; meshletIndex += 1)
+        {
+            meshlets[meshletIndex] = Meshlet();
+            meshlets[meshletIndex].firstFace = cachedMeshlets[meshletIndex].firstFace;
+            meshlets[meshletIndex].facesLength = cachedMeshlets[meshletIndex].facesLength;
+        }
+        normalWeighting = (NormalWeighting)header.normalWeighting;
+        return true;
+    }
+
+    // A cache of the right size can still be damaged. Every reference must
+    // stay in its array, symmetric edges must pair up and vertex edges must
+    // start at their vertex, or the walks round a vertex would leave the mesh
+    // or never end.
+    static bool isCacheValid(const MeshCacheHeader& header, const U32* vertexEdges, const U32* indices, const U32* symmetricEdges, const CachedMeshlet* meshlets)
+    {
+        for (U32 edge = 0; edge < header.indexCount; edge += 1)
+        {
+            if (header.vertexCount <= indices[edge]) return false;
+            U32 symmetric = symmetricEdges[edge];
+            if (symmetric == NO_INDEX) continue;
+            if (header.indexCount <= symmetric || symmetricEdges[symmetric] != edge) return false;
+        }
+        for (U32 vertex = 0; vertex < header.vertexCount; vertex += 1)
+        {
+            U32 edge = vertexEdges[vertex];
+            if (edge != NO_INDEX && (header.indexCount <= edge || indices[edge] != vertex)) return false;
+        }
+        for (U32 meshletIndex = 0; meshletIndex < header.meshletCount; meshletIndex += 1)
+        {
+            const CachedMeshlet& meshlet = meshlets[meshletIndex];
+            if (header.faceCount < meshlet.firstFace || header.faceCount - meshlet.firstFace < meshlet.facesLength) return false;
+        }
+        return true;
+    }
+
+    void writeCache(const std::string& path, U64 sourceHash)
+    {
+        MeshCacheHeader header = {};
+        header.magic = MESH_CACHE_MAGIC;
+        header.version = MESH_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.vertexCount = vertices.size();
+        header.indexCount = indices.size();
+        header.faceCount = faceNormals.size();
+        header.edgeCount = symmetricEdges.size();
+        header.normalWeighting = normalWeighting;
+        header.meshletCount = meshlets.size();
+
+        std::vector<CachedVertex> cachedVertices(header.vertexCount);
+        for (U32 vertexIndex = 0; vertexIndex < header.vertexCount; vertexIndex += 1)
+        {
+            cachedVertices[vertexIndex].position = vertices[vertexIndex].position;
+            cachedVertices[vertexIndex].normal = vertices[vertexIndex].normal;
+        }
+        std::vector<CachedMeshlet> cachedMeshlets(header.meshletCount);
+        for (U32 meshletIndex = 0; meshletIndex < header.meshletCount; meshletIndex += 1)
+        {
+            cachedMeshlets[meshletIndex] = {meshlets[meshletIndex].firstFace, meshlets[meshletIndex].facesLength};
+        }
+
+        // write beside the final path and rename, so a reader never maps a half-written cache
+        std::string   temporaryPath = path + ".tmp";
+        std::ofstream file = std::ofstream(temporaryPath, std::ios::binary);
+        file.write((const char*)&header, sizeof(MeshCacheHeader));
+        file.write((const char*)cachedVertices.data(), cachedVertices.size() * sizeof(CachedVertex));
+        file.write((const char*)vertexEdges.data(), vertexEdges.size() * sizeof(U32));
+        file.write((const char*)indices.data(), indices.size() * sizeof(U32));
+        file.write((const char*)symmetricEdges.data(), symmetricEdges.size() * sizeof(U32));
+        file.write((const char*)faceNormals.data(), faceNormals.size() * sizeof(V3));
+        file.write((const char*)cachedMeshlets.data(), cachedMeshlets.size() * sizeof(CachedMeshlet));
+        file.close();
+
+        if (!file || rename(temporaryPath.c_str(), path.c_str()) != 0)
+        {
+            std::cout << "mesh cache not written: " << path << std::endl;
+            remove(temporaryPath.c_str());
+        }
     }
 
     void createWingedEdgeMesh()
     {
-        facesLength = indices.size() / 3;
-        edgesLength = indices.size();
+        U32 facesLength = indices.size() / 3;
+        U32 edgesLength = facesLength * 3;
 
-        faces = new Face[facesLength];
-        edges = new Edge[edgesLength];
+        symmetricEdges.resize(edgesLength);
+        vertexEdges.assign(vertices.size(), NO_INDEX);
 
-        std::unordered_map<std::string, U32> edgeIndexMap;
+        matchSymmetricEdges();
+        computeNormals(normalWeighting);
+    }
 
-        for (U32 faceIndex = 0; faceIndex * 3 < indices.size(); faceIndex += 1)
+    // Face normals in one sweep over the faces, then every face adds its
+    // weighted normal to its three corners. Nothing walks a one-ring, so the
+    // cost is a few linear passes whatever the connectivity looks like.
+    void computeNormals(NormalWeighting weighting)
+    {
+        U32 facesLength = indices.size() / 3;
+        U32 verticesLength = vertices.size();
+        normalWeighting = weighting;
+        faceNormals.resize(facesLength);
+
+        // Each thread sweeps its own range of faces, computing their normals and
+        // adding what they give their corners into its own copy of the sums:
+        // the unit normal unless weighting by area, scaled per corner by its
+        // angle when weighting by angle. The copies are then added up per
+        // vertex in thread order, so no two threads write the same sum and
+        // the result does not depend on how the threads were scheduled.
+        U32 taskCount = std::max(1u, std::min(getThreadCount(), facesLength / 16384));
+        arena.reset();
+        V3* normalSums = arena.allocate<V3>((U64)taskCount * verticesLength);
+
+        parallelTasks(taskCount, [&](U32 taskIndex) {
+            V3* sums = normalSums + (U64)taskIndex * verticesLength;
+            std::fill(sums, sums + verticesLength, V3());
+
+            U32 end = (U64)facesLength * (taskIndex + 1) / taskCount;
+            for (U32 faceIndex = (U64)facesLength * taskIndex / taskCount; faceIndex < end; faceIndex += 1)
+            {
+                const U32* corners = &indices[faceIndex * 3];
+                V3         position1 = vertices[corners[0]].position;
+                V3         position2 = vertices[corners[1]].position;
+                V3         position3 = vertices[corners[2]].position;
+
+                // twice the area long, so a degenerate face has no direction to add
+                V3  areaNormal = cross(position1 - position2, position1 - position3);
+                F32 doubleArea = length(areaNormal);
+                faceNormals[faceIndex] = 0 < doubleArea ? areaNormal * (1 / doubleArea) : V3();
+                V3 faceVector = weighting == AREA_WEIGHTING ? areaNormal : faceNormals[faceIndex];
+
+                if (weighting == ANGLE_WEIGHTING)
+                {
+                    V3  side12 = position2 - position1;
+                    V3  side23 = position3 - position2;
+                    V3  side31 = position1 - position3;
+                    F32 length12 = length(side12);
+                    F32 length23 = length(side23);
+                    F32 length31 = length(side31);
+
+                    sums[corners[0]] = sums[corners[0]] + faceVector * getCornerAngle(-dot(side12, side31), length12 * length31);
+                    sums[corners[1]] = sums[corners[1]] + faceVector * getCornerAngle(-dot(side23, side12), length23 * length12);
+                    sums[corners[2]] = sums[corners[2]] + faceVector * getCornerAngle(-dot(side31, side23), length31 * length23);
+                }
+                else
+                {
+                    sums[corners[0]] = sums[corners[0]] + faceVector;
+                    sums[corners[1]] = sums[corners[1]] + faceVector;
+                    sums[corners[2]] = sums[corners[2]] + faceVector;
+                }
+            }
+        });
+
+        parallelFor(verticesLength, [&](U32 begin, U32 end) {
+            for (U32 vertexIndex = begin; vertexIndex < end; vertexIndex += 1)
+            {
+                V3 sum = normalSums[vertexIndex];
+                for (U32 taskIndex = 1; taskIndex < taskCount; taskIndex += 1)
+                {
+                    sum = sum + normalSums[(U64)taskIndex * verticesLength + vertexIndex];
+                }
+                F32 sumLength = length(sum);
+                vertices[vertexIndex].normal = 0 < sumLength ? sum * (1 / sumLength) : V3();
+            }
+        });
+    }
+
+    // angle of a corner from the dot product of its two sides and their lengths multiplied
+    static F32 getCornerAngle(F32 sidesDot, F32 sidesLength)
+    {
+        if (sidesLength == 0) return 0;
+        return acos(std::max(-1.0f, std::min(1.0f, sidesDot / sidesLength)));
+    }
+
+    // Pairs every half-edge (a, b) with its opposite (b, a) by radix sorting
+    // the edges on their packed vertex indices and binary searching for the
+    // reversed key. Edges whose key is not unique (non-manifold) or that have
+    // no opposite (open boundary) are left without a symmetric edge, which
+    // keeps the symmetric relation an involution and every fan walk finite.
+    // The sorted keys also hand each vertex its outgoing edge.
+    void matchSymmetricEdges()
+    {
+        U32 edgesLength = symmetricEdges.size();
+
+        arena.reset();
+        EdgeKey* keys = arena.allocate<EdgeKey>(edgesLength);
+        EdgeKey* scratch = arena.allocate<EdgeKey>(edgesLength);
+        parallelFor(edgesLength, [&](U32 begin, U32 end) {
+            for (U32 edgeIndex = begin; edgeIndex < end; edgeIndex += 1)
+            {
+                keys[edgeIndex] = EdgeKey(indices[edgeIndex], indices[getNextEdge(edgeIndex)], edgeIndex);
+            }
+        });
+
+        // only the bits a vertex index can use need sorting
+        U32 vertexBits = 0;
+        while (vertexBits < 32 && ((U64)1 << vertexBits) < vertices.size()) vertexBits++;
+        parallelRadixSort(keys, scratch, edgesLength, vertexBits * 2, [vertexBits](const EdgeKey& key) {
+            return key.key >> 32 << vertexBits | (key.key & 0xFFFFFFFF);
+        });
+
+        parallelFor(edgesLength, [&](U32 begin, U32 end) {
+            for (U32 keyIndex = begin; keyIndex < end; keyIndex += 1)
+            {
+                EdgeKey key = keys[keyIndex];
+                symmetricEdges[key.edge] = NO_INDEX;
+
+                // the first key of every run of one start vertex hands that vertex the
+                // highest numbered edge leaving it, matching what a serial build keeps
+                if (keyIndex == 0 || keys[keyIndex - 1].key >> 32 != key.key >> 32)
+                {
+                    U32 vertexEdge = key.edge;
+                    for (U32 runIndex = keyIndex + 1; runIndex < edgesLength && keys[runIndex].key >> 32 == key.key >> 32; runIndex += 1)
+                    {
+                        vertexEdge = std::max(vertexEdge, keys[runIndex].edge);
+                    }
+                    vertexEdges[key.key >> 32] = vertexEdge;
+                }
+
+                bool isUnique = (keyIndex == 0 || keys[keyIndex - 1].key != key.key) && (keyIndex + 1 == edgesLength || keys[keyIndex + 1].key != key.key);
+                if (!isUnique) continue;
+
+                U64  reversed = key.reversed();
+                EdgeKey* keysEnd = keys + edgesLength;
+                EdgeKey* match = std::lower_bound(keys, keysEnd, reversed, [](EdgeKey k, U64 value) { return k.key < value; });
+                if (match == keysEnd || match->key != reversed) continue;
+                if (match + 1 != keysEnd && (match + 1)->key == reversed) continue;
+
+                symmetricEdges[key.edge] = match->edge;
+            }
+        });
+    }
+
+    // Calls function(edge) for every edge leaving vertex, turning around it
+    // through the symmetric edge's next. An open boundary cuts the fan, so the
+    // walk continues backward from the first edge. Returns the border edge
+    // that comes into vertex at the end of the backward walk, or NO_INDEX if
+    // the fan is closed.
+    template <typename F>
+    U32 forEachOutgoingEdge(U32 vertex, F function)
+    {
+        U32 firstEdge = vertexEdges[vertex];
+        U32 currentEdge = firstEdge;
+        while (true)
         {
-            // face
-            faces[faceIndex] = Face();
-            Face* face = &faces[faceIndex];
+            function(currentEdge);
+            if (symmetricEdges[currentEdge] == NO_INDEX) break;
+            currentEdge = getNextEdge(symmetricEdges[currentEdge]);
+            if (currentEdge == firstEdge) return NO_INDEX;
+        }
 
-            // edge
-            U32 edgeIndex1 = faceIndex * 3 + 0;
-            edges[edgeIndex1] = Edge();
-            Edge* edge1 = &edges[edgeIndex1];
+        U32 incomingEdge = getPreviousEdge(firstEdge);
+        while (symmetricEdges[incomingEdge] != NO_INDEX)
+        {
+            currentEdge = symmetricEdges[incomingEdge];
+            function(currentEdge);
+            incomingEdge = getPreviousEdge(currentEdge);
+        }
+        return incomingEdge;
+    }
 
-            U32 edgeIndex2 = faceIndex * 3 + 1;
-            edges[edgeIndex2] = Edge();
-            Edge* edge2 = &edges[edgeIndex2];
+    // Uploads the mesh in one of two layouts. Expanded, every face gets its
+    // own three corners, drawn with glDrawArrays; the vertex shader takes the
+    // wireframe barycentrics from gl_VertexID. Indexed, each vertex is uploaded
+    // once next to the element buffer, 16-bit when there are few enough
+    // vertices, and the geometry shader makes up the barycentrics and the
+    // flat normals per triangle. Either way a vertex is a PackedPosition and
+    // a PackedNormal, 12 bytes, in two ranges of vertexBufferCapacity entries
+    // so the normals can be rewritten without the positions. Buffers and the
+    // vertex array are made once and only reallocated when the mesh outgrows
+    // them or the layout changes.
+    void load(bool isSmooth = true, bool isIndexed = false)
+    {
+        OUT("start load");
+        orderedVerticesLength = indices.size();
+        if (vertexArray == 0)
+        {
+            glGenVertexArrays(1, &vertexArray);
+            glGenVertexArrays(1, &instancedVertexArray);
+            glGenBuffers(1, &vertexBuffer);
+            glGenBuffers(1, &elementBuffer);
+            for (U32 array : {vertexArray, instancedVertexArray})
+            {
+                glBindVertexArray(array);
+                glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, elementBuffer);
+                glEnableVertexAttribArray(0);
+                glEnableVertexAttribArray(2);
+            }
+            // the model matrix rows advance per instance; InstanceBatches points them at its buffer
+            for (U32 attribute = INSTANCE_MODEL_ATTRIBUTE; attribute < INSTANCE_MODEL_ATTRIBUTE + 4; attribute += 1)
+            {
+                glEnableVertexAttribArray(attribute);
+                glVertexAttribDivisor(attribute, 1);
+            }
+        }
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
 
-            U32 edgeIndex3 = faceIndex * 3 + 2;
-            edges[edgeIndex3] = Edge();
-            Edge* edge3 = &edges[edgeIndex3];
+        if (isLoadedIndexed != isIndexed)
+        {
+            isLoadedIndexed = isIndexed;
+            vertexBufferCapacity = 0;
+        }
 
-            // vertex
-            Vertex* vertex1 = &vertices[indices[faceIndex * 3 + 0]];
-            Vertex* vertex2 = &vertices[indices[faceIndex * 3 + 1]];
-            Vertex* vertex3 = &vertices[indices[faceIndex * 3 + 2]];
+        U32 length = isIndexed ? vertices.size() : orderedVerticesLength;
+        if (vertexBufferCapacity < length)
+        {
+            // half as much again, so refining a little at a time does not reallocate every step
+            vertexBufferCapacity = std::max(length, vertexBufferCapacity + vertexBufferCapacity / 2);
+            glBufferData(GL_ARRAY_BUFFER, (U64)vertexBufferCapacity * (sizeof(PackedPosition) + sizeof(PackedNormal)), nullptr, GL_DYNAMIC_DRAW);
 
-            // face
-            face->edge = edge1;
-            face->normal = normalize(cross(vertex1->position - vertex2->position, vertex1->position - vertex3->position));
+            for (U32 array : {vertexArray, instancedVertexArray})
+            {
+                glBindVertexArray(array);
+                glVertexAttribPointer(0, 4, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedPosition), (void*)0);
+                glVertexAttribPointer(2, 2, GL_SHORT, GL_TRUE, sizeof(PackedNormal), (void*)getNormalsOffset());
+            }
+        }
+        glBindVertexArray(vertexArray);
 
-            // edge
-            edge1->next = edge2;
-            edge1->previous = edge3;
-            edge1->start = vertex1;
-            edge1->end = vertex2;
-            edge1->face = face;
-            edgeIndexMap[vertex1->position.string() + vertex2->position.string()] = edgeIndex1;
+        // the bounds the positions are quantized in, the shaders scale them back
+        V3 boundsMax = vertices.empty() ? V3() : vertices[0].position;
+        boundsMin = boundsMax;
+        for (const Vertex& vertex : vertices)
+        {
+            boundsMin = V3(std::min(boundsMin.x, vertex.position.x), std::min(boundsMin.y, vertex.position.y), std::min(boundsMin.z, vertex.position.z));
+            boundsMax = V3(std::max(boundsMax.x, vertex.position.x), std::max(boundsMax.y, vertex.position.y), std::max(boundsMax.z, vertex.position.z));
+        }
+        boundsSize = boundsMax - boundsMin;
 
-            edge2->next = edge3;
-            edge2->previous = edge1;
-            edge2->start = vertex2;
-            edge2->end = vertex3;
-            edge2->face = face;
-            edgeIndexMap[vertex2->position.string() + vertex3->position.string()] = edgeIndex2;
+        // the same box as the entity's bounds, with the sphere around its middle
+        boundsExtent = boundsSize * 0.5f;
+        boundsCenter = boundsMin + boundsExtent;
+        F32 radiusSquared = 0;
+        for (Vertex& vertex : vertices)
+        {
+            V3 offset = vertex.position - boundsCenter;
+            radiusSquared = std::max(radiusSquared, dot(offset, offset));
+        }
+        boundsRadius = sqrtf(radiusSquared);
 
-            edge3->next = edge1;
-            edge3->previous = edge2;
-            edge3->start = vertex3;
-            edge3->end = vertex1;
-            edge3->face = face;
-            edgeIndexMap[vertex3->position.string() + vertex1->position.string()] = edgeIndex3;
+        V3 scale = V3(0 < boundsSize.x ? 65535 / boundsSize.x : 0, 0 < boundsSize.y ? 65535 / boundsSize.y : 0, 0 < boundsSize.z ? 65535 / boundsSize.z : 0);
+        auto packPosition = [&](U32 vertex) -> PackedPosition {
+            V3 position = (vertices[vertex].position - boundsMin) * scale;
+            return {(U16)lroundf(position.x), (U16)lroundf(position.y), (U16)lroundf(position.z), 0};
+        };
 
-            // vertex
-            vertex1->edge = edge1;
-            vertex2->edge = edge2;
-            vertex3->edge = edge3;
+        if (isIndexed)
+        {
+            // vertices numbered below 2^16 fit 16-bit indices, half the element buffer
+            indexType = vertices.size() <= 0x10000 ? GL_UNSIGNED_SHORT : GL_UNSIGNED_INT;
+            U32 indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(U16) : sizeof(U32);
+            if (elementBufferCapacity < (U64)orderedVerticesLength * indexSize)
+            {
+                elementBufferCapacity = std::max<U64>((U64)orderedVerticesLength * indexSize, elementBufferCapacity + elementBufferCapacity / 2);
+                glBufferData(GL_ELEMENT_ARRAY_BUFFER, elementBufferCapacity, nullptr, GL_DYNAMIC_DRAW);
+            }
+            if (indexType == GL_UNSIGNED_SHORT)
+            {
+                writeBuffer<U16>(GL_ELEMENT_ARRAY_BUFFER, 0, orderedVerticesLength, [&](U32 corner) { return indices[corner]; });
+            }
+            else
+            {
+                writeBuffer<U32>(GL_ELEMENT_ARRAY_BUFFER, 0, orderedVerticesLength, [&](U32 corner) { return indices[corner]; });
+            }
+            writeBuffer<PackedPosition>(GL_ARRAY_BUFFER, 0, vertices.size(), packPosition);
+        }
+        else
+        {
+            writeBuffer<PackedPosition>(GL_ARRAY_BUFFER, 0, orderedVerticesLength, [&](U32 corner) { return packPosition(indices[corner]); });
         }
+        writeNormals(isSmooth);
+        computeMeshletBounds();
+
+        glBindVertexArray(0);
+        OUT("end load");
+    }
 
-        for (U32 edgeIndex = 0; edgeIndex < edgesLength; edgeIndex += 1)
+    // Rewrites just the normals, for when only the shading changed. Falls back
+    // to a full load() if the faces changed since the last one.
+    void loadNormals(bool isSmooth = true)
+    {
+        if (vertexArray == 0 || orderedVerticesLength != indices.size())
         {
-            Edge* edge = &edges[edgeIndex];
-            edge->symmetric = &edges[edgeIndexMap[edge->end->position.string() + edge->start->position.string()]];
+            load(isSmooth, isLoadedIndexed);
+            return;
         }
 
-        for (U32 vertexIndex = 0; vertexIndex < vertices.size(); vertexIndex += 1)
+        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
+        writeNormals(isSmooth);
+    }
+
+    // indexed, flat normals come from the geometry shader and the vertex normals are always the smooth ones
+    void writeNormals(bool isSmooth)
+    {
+        if (isLoadedIndexed)
         {
-            Vertex* vertex = &vertices[vertexIndex];
-            vertex->normal = getMeanNormal(*vertex);
+            writeBuffer<PackedNormal>(GL_ARRAY_BUFFER, getNormalsOffset(), vertices.size(), [&](U32 vertex) { return packNormal(vertices[vertex].normal); });
         }
+        else if (isSmooth)
+        {
+            writeBuffer<PackedNormal>(GL_ARRAY_BUFFER, getNormalsOffset(), orderedVerticesLength, [&](U32 corner) { return packNormal(vertices[indices[corner]].normal); });
+        }
+        else
+        {
+            writeBuffer<PackedNormal>(GL_ARRAY_BUFFER, getNormalsOffset(), orderedVerticesLength, [&](U32 corner) { return packNormal(faceNormals[corner / 3]); });
+        }
+    }
+
+    // the normals range follows the positions
+    U64 getNormalsOffset()
+    {
+        return (U64)vertexBufferCapacity * sizeof(PackedPosition);
     }
 
-    V3 getMeanNormal(Vertex& vertex)
+    // Fills count values of type T from offset in the buffer bound to target
+    // with getValue(index), straight into mapped memory. The range is
+    // invalidated, so the driver need not keep its old contents for a draw
+    // still in flight.
+    template <typename T, typename F>
+    void writeBuffer(GLenum target, U64 offset, U32 count, F getValue)
     {
-        V3    normalSum = vertex.edge->face->normal;
-        Edge* startingEdge = vertex.edge;
-        Edge* currentEdge = startingEdge->symmetric->next;
-        while (!(startingEdge->end->position == currentEdge->end->position))
+        if (count == 0) return;
+
+        T* values = (T*)glMapBufferRange(target, offset, (U64)count * sizeof(T), GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT);
+        if (values == nullptr)
         {
-            normalSum = normalSum + currentEdge->face->normal;
-            currentEdge = currentEdge->symmetric->next;
+            std::cout << "buffer not mapped." << std::endl;
+            return;
+        }
+        parallelFor(count, [&](U32 begin, U32 end) {
+            for (U32 index = begin; index < end; index += 1)
+            {
+                values[index] = getValue(index);
+            }
+        });
+        if (!glUnmapBuffer(target))
+        {
+            // contents lost while mapped, the next load() reallocates and writes everything again
+            std::cout << "buffer lost." << std::endl;
+            vertexBufferCapacity = 0;
+            elementBufferCapacity = 0;
         }
-        return normalize(normalSum);
     }
 
-    void load(bool isSmooth = true)
+    // position of an old vertex after subdivision: Loop's weighted average of
+    // it and its neighbours inside the mesh, 3/4 of it and 1/8 of each of its
+    // two neighbours along an open boundary
+    V3 getEvenPosition(U32 vertex)
     {
-        orderedVerticesLength = indices.size();
-        orderedVertices = new Vertex[orderedVerticesLength];
-        OUT("start load");
+        V3  position = vertices[vertex].position;
+        V3  neighbourSum;
+        U32 degree = 0;
+        U32 outgoingBorderEdge = NO_INDEX;
+        U32 incomingBorderEdge = forEachOutgoingEdge(vertex, [&](U32 edge) {
+            neighbourSum = neighbourSum + vertices[indices[getNextEdge(edge)]].position;
+            degree += 1;
+            if (symmetricEdges[edge] == NO_INDEX) outgoingBorderEdge = edge;
+        });
+
+        if (incomingBorderEdge != NO_INDEX)
+        {
+            V3 previousPosition = vertices[indices[incomingBorderEdge]].position;
+            V3 nextPosition = vertices[indices[getNextEdge(outgoingBorderEdge)]].position;
+            return position * 3 / 4 + (previousPosition + nextPosition) / 8;
+        }
 
-        for (U32 faceIndex = 0; faceIndex < facesLength; faceIndex += 1)
+        F32 weight = getLoopWeight(degree);
+        return position * (1 - weight * degree) + neighbourSum * weight;
+    }
+
+    // position of the vertex inserted on edge: the 3/8, 3/8, 1/8, 1/8 Loop
+    // stencil inside the mesh, the midpoint on an open boundary
+    V3 getOddPosition(U32 edge)
+    {
+        V3 startPosition = vertices[indices[edge]].position;
+        V3 endPosition = vertices[indices[getNextEdge(edge)]].position;
+        if (symmetricEdges[edge] == NO_INDEX) return (startPosition + endPosition) / 2;
+
+        V3 farPosition = vertices[indices[getPreviousEdge(edge)]].position;
+        V3 oppositePosition = vertices[indices[getPreviousEdge(symmetricEdges[edge])]].position;
+        return startPosition * 3 / 8 + endPosition * 3 / 8 + farPosition * 1 / 8 + oppositePosition * 1 / 8;
+    }
+
+    // Subdivides levels times in one call. The levels in between are never
+    // shaded or uploaded: they only exist as the arrays refine() reads while
+    // writing the next level into the spare ones, and the normals are computed
+    // for the final level alone.
+    void subdivide(U32 levels = 1)
+    {
+        for (U32 level = 0; level < levels; level += 1)
         {
-            orderedVertices[faceIndex * 3 + 0] = *faces[faceIndex].edge->start;
-            orderedVertices[faceIndex * 3 + 1] = *faces[faceIndex].edge->next->start;
-            orderedVertices[faceIndex * 3 + 2] = *faces[faceIndex].edge->next->next->start;
+            refine();
+        }
+        computeNormals(normalWeighting);
+        optimizeOrder();
+    }
 
-            orderedVertices[faceIndex * 3 + 0].barycentric = V3(1, 0, 0);
-            orderedVertices[faceIndex * 3 + 1].barycentric = V3(0, 1, 0);
-            orderedVertices[faceIndex * 3 + 2].barycentric = V3(0, 0, 1);
+    // Renumbers faces and vertices for the GPU: faces in Tipsify order for
+    // the vertex cache, optionally regrouped so outward facing clusters draw
+    // first and hide the rest, then vertices in the order the faces first use
+    // them. Every array follows, the last stencil table included, so the mesh
+    // is the same surface with new numbers. Returns the new number of every
+    // old vertex, in the arena.
+    const U32* optimizeOrder()
+    {
+        U32 facesLength = indices.size() / 3;
+        U32 verticesLength = vertices.size();
+
+        arena.reset();
+        cacheStatisticsBefore = getVertexCacheStatistics(arena, indices.data(), indices.size(), verticesLength);
+
+        U32* faceOrder = arena.allocate<U32>(facesLength);
+        U8*  isBlockStart = arena.allocate<U8>(facesLength);
+        U32* vertexRemap = arena.allocate<U32>(verticesLength);
+        U32* newFaces = arena.allocate<U32>(facesLength);
+        orderFacesForVertexCache(arena, indices.data(), facesLength, verticesLength, faceOrder, isBlockStart);
+        if (isOverdrawOrdered)
+        {
+            V3* positions = arena.allocate<V3>(verticesLength);
+            for (U32 vertexIndex = 0; vertexIndex < verticesLength; vertexIndex += 1)
+            {
+                positions[vertexIndex] = vertices[vertexIndex].position;
+            }
+            orderClustersForOverdraw(arena, indices.data(), positions, facesLength, verticesLength, faceOrder, isBlockStart);
+        }
+        orderFacesIntoMeshlets(arena, indices.data(), symmetricEdges.data(), facesLength, verticesLength, faceOrder, meshlets);
+        orderVerticesForFetch(indices.data(), facesLength, verticesLength, faceOrder, vertexRemap);
+
+        parallelFor(facesLength, [&](U32 begin, U32 end) {
+            for (U32 faceIndex = begin; faceIndex < end; faceIndex += 1)
+            {
+                newFaces[faceOrder[faceIndex]] = faceIndex;
+            }
+        });
+        auto getNewEdge = [&](U32 edge) { return edge == NO_INDEX ? NO_INDEX : newFaces[edge / 3] * 3 + edge % 3; };
+
+        std::vector<Vertex>& newVertices = spareVertices;
+        std::vector<U32>&    newIndices = spareIndices;
+        std::vector<U32>&    newSymmetricEdges = spareSymmetricEdges;
+        std::vector<V3>&     newFaceNormals = spareFaceNormals;
+        newVertices.resize(verticesLength);
+        newIndices.resize(facesLength * 3);
+        newSymmetricEdges.resize(facesLength * 3);
+        newFaceNormals.resize(facesLength);
+
+        parallelFor(facesLength, [&](U32 begin, U32 end) {
+            for (U32 faceIndex = begin; faceIndex < end; faceIndex += 1)
+            {
+                U32 oldFace = faceOrder[faceIndex];
+                for (U32 corner = 0; corner < 3; corner += 1)
+                {
+                    newIndices[faceIndex * 3 + corner] = vertexRemap[indices[oldFace * 3 + corner]];
+                    newSymmetricEdges[faceIndex * 3 + corner] = getNewEdge(symmetricEdges[oldFace * 3 + corner]);
+                }
+                newFaceNormals[faceIndex] = faceNormals[oldFace];
+            }
+        });
 
-            if (!isSmooth)
+        // vertexEdges is rewritten in place from a copy of the old one
+        U32* oldVertexEdges = arena.allocate<U32>(verticesLength);
+        std::copy(vertexEdges.begin(), vertexEdges.end(), oldVertexEdges);
+        parallelFor(verticesLength, [&](U32 begin, U32 end) {
+            for (U32 vertexIndex = begin; vertexIndex < end; vertexIndex += 1)
             {
-                orderedVertices[faceIndex * 3 + 0].normal = faces[faceIndex].normal;
-                orderedVertices[faceIndex * 3 + 1].normal = faces[faceIndex].normal;
-                orderedVertices[faceIndex * 3 + 2].normal = faces[faceIndex].normal;
+                newVertices[vertexRemap[vertexIndex]] = vertices[vertexIndex];
+                vertexEdges[vertexRemap[vertexIndex]] = getNewEdge(oldVertexEdges[vertexIndex]);
             }
+        });
+
+        std::swap(vertices, newVertices);
+        std::swap(indices, newIndices);
+        std::swap(symmetricEdges, newSymmetricEdges);
+        std::swap(faceNormals, newFaceNormals);
+
+        // the last stencil level's rows are the vertices, so they are renumbered with them
+        if (!stencilTables.empty() && stencilTables.back().getRowsLength() == verticesLength)
+        {
+            stencilTables.back().reorderRows(vertexRemap);
         }
 
-        // vertex array object
-        glGenVertexArrays(1, &vertexArray);
-        glBindVertexArray(vertexArray);
+        cacheStatisticsAfter = getVertexCacheStatistics(arena, indices.data(), indices.size(), verticesLength);
+        return vertexRemap;
+    }
 
-        // vertex buffer object
-        glGenBuffers(1, &vertexBuffer);
-        glBindBuffer(GL_ARRAY_BUFFER, vertexBuffer);
-        glBufferData(GL_ARRAY_BUFFER, orderedVerticesLength * sizeof(Vertex), &orderedVertices[0], GL_STATIC_DRAW);
+    // One level of Loop subdivision, positions and connectivity only, leaving
+    // the normals to the caller. Every face splits into four around one new (odd)
+    // vertex per edge. The two halves of an edge are symmetric edges, so odd
+    // vertices are numbered from the connectivity alone, and the connectivity
+    // of the refined mesh follows from the old one without matching anything:
+    //
+    //   face 4f + 0: vertex1, odd1, odd3     odd1 splits edge 3f + 0
+    //   face 4f + 1: vertex2, odd2, odd1     odd2 splits edge 3f + 1
+    //   face 4f + 2: vertex3, odd3, odd2     odd3 splits edge 3f + 2
+    //   face 4f + 3: odd1, odd2, odd3
+    void refine()
+    {
+        U32 verticesLength = vertices.size();
+        U32 facesLength = indices.size() / 3;
+        U32 edgesLength = facesLength * 3;
+
+        // the odd vertex on every half-edge, numbered after the even vertices in
+        // the order of the half-edges that own them
+        arena.reset();
+        U32* oddVertices = arena.allocate<U32>(edgesLength);
+        U32  oddVerticesLength = parallelCompact(
+            edgesLength, [&](U32 edgeIndex) { return isOddVertexOwner(edgeIndex); },
+            [&](U32 edgeIndex, U32 number) { oddVertices[edgeIndex] = verticesLength + number; });
+        parallelFor(edgesLength, [&](U32 begin, U32 end) {
+            for (U32 edgeIndex = begin; edgeIndex < end; edgeIndex += 1)
+            {
+                if (!isOddVertexOwner(edgeIndex)) oddVertices[edgeIndex] = oddVertices[symmetricEdges[edgeIndex]];
+            }
+        });
+
+        std::vector<Vertex>& newVertices = spareVertices;
+        std::vector<U32>&    newIndices = spareIndices;
+        std::vector<U32>&    newSymmetricEdges = spareSymmetricEdges;
+        newVertices.resize(verticesLength + oddVerticesLength);
+        newIndices.resize(facesLength * 12);
+        newSymmetricEdges.resize(edgesLength * 4);
+
+        // every pass below writes each output once from the old mesh only, so
+        // splitting them across threads gives the same result as running serially
+        parallelFor(verticesLength, [&](U32 begin, U32 end) {
+            for (U32 vertexIndex = begin; vertexIndex < end; vertexIndex += 1)
+            {
+                bool isReferenced = vertexEdges[vertexIndex] != NO_INDEX;
+                newVertices[vertexIndex] = Vertex(isReferenced ? getEvenPosition(vertexIndex) : vertices[vertexIndex].position);
+            }
+        });
+        parallelFor(edgesLength, [&](U32 begin, U32 end) {
+            for (U32 edgeIndex = begin; edgeIndex < end; edgeIndex += 1)
+            {
+                if (isOddVertexOwner(edgeIndex)) newVertices[oddVertices[edgeIndex]] = Vertex(getOddPosition(edgeIndex));
+            }
+        });
 
-        // vertex positions
-        glEnableVertexAttribArray(0);
-        glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, position));
+        parallelFor(facesLength, [&](U32 begin, U32 end) {
+            for (U32 faceIndex = begin; faceIndex < end; faceIndex += 1)
+            {
+                U32 vertexIndex1 = indices[faceIndex * 3 + 0];
+                U32 vertexIndex2 = indices[faceIndex * 3 + 1];
+                U32 vertexIndex3 = indices[faceIndex * 3 + 2];
+
+                U32 oddVertexIndex1 = oddVertices[faceIndex * 3 + 0];
+                U32 oddVertexIndex2 = oddVertices[faceIndex * 3 + 1];
+                U32 oddVertexIndex3 = oddVertices[faceIndex * 3 + 2];
+
+                U32* faceIndices = &newIndices[faceIndex * 12];
+                faceIndices[0] = vertexIndex1, faceIndices[1] = oddVertexIndex1, faceIndices[2] = oddVertexIndex3;
+                faceIndices[3] = vertexIndex2, faceIndices[4] = oddVertexIndex2, faceIndices[5] = oddVertexIndex1;
+                faceIndices[6] = vertexIndex3, faceIndices[7] = oddVertexIndex3, faceIndices[8] = oddVertexIndex2;
+                faceIndices[9] = oddVertexIndex1, faceIndices[10] = oddVertexIndex2, faceIndices[11] = oddVertexIndex3;
+
+                // the inner edges pair up within the face, the outer halves with the
+                // halves of the old symmetric edge, start half with end half
+                U32  firstEdge = faceIndex * 12;
+                U32* faceSymmetricEdges = &newSymmetricEdges[firstEdge];
+                faceSymmetricEdges[1] = firstEdge + 11, faceSymmetricEdges[11] = firstEdge + 1;
+                faceSymmetricEdges[4] = firstEdge + 9, faceSymmetricEdges[9] = firstEdge + 4;
+                faceSymmetricEdges[7] = firstEdge + 10, faceSymmetricEdges[10] = firstEdge + 7;
+                for (U32 edgeIndex = faceIndex * 3; edgeIndex < faceIndex * 3 + 3; edgeIndex += 1)
+                {
+                    U32 symmetricEdge = symmetricEdges[edgeIndex];
+                    newSymmetricEdges[getStartHalfEdge(edgeIndex)] = symmetricEdge == NO_INDEX ? NO_INDEX : getEndHalfEdge(symmetricEdge);
+                    newSymmetricEdges[getEndHalfEdge(edgeIndex)] = symmetricEdge == NO_INDEX ? NO_INDEX : getStartHalfEdge(symmetricEdge);
+                }
+            }
+        });
 
-        // vertex barycentrics
-        glEnableVertexAttribArray(1);
-        glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, barycentric));
+        // an even vertex leaves through the start half of its old edge, an odd
+        // vertex through the end half of the edge it splits
+        vertexEdges.resize(verticesLength + oddVerticesLength);
+        parallelFor(verticesLength, [&](U32 begin, U32 end) {
+            for (U32 vertexIndex = begin; vertexIndex < end; vertexIndex += 1)
+            {
+                if (vertexEdges[vertexIndex] != NO_INDEX) vertexEdges[vertexIndex] = getStartHalfEdge(vertexEdges[vertexIndex]);
+            }
+        });
+        parallelFor(edgesLength, [&](U32 begin, U32 end) {
+            for (U32 edgeIndex = begin; edgeIndex < end; edgeIndex += 1)
+            {
+                if (isOddVertexOwner(edgeIndex)) vertexEdges[oddVertices[edgeIndex]] = getEndHalfEdge(edgeIndex);
+            }
+        });
 
-        // vertex normals
-        glEnableVertexAttribArray(2);
-        glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void*)offsetof(Vertex, normal));
+        std::swap(vertices, newVertices);
+        std::swap(indices, newIndices);
+        std::swap(symmetricEdges, newSymmetricEdges);
+    }
 
-        OUT("end load");
+    // Moves every vertex to the point the Loop surface converges to and gives
+    // it the exact normal there, from the limit and tangent masks of its
+    // one-ring. A mesh refined once or twice and projected shades like one
+    // refined several times more.
+    void projectToLimit()
+    {
+        std::vector<Vertex>& limitVertices = spareVertices;
+        limitVertices.resize(vertices.size());
+        parallelFor(vertices.size(), [&](U32 begin, U32 end) {
+            for (U32 vertexIndex = begin; vertexIndex < end; vertexIndex += 1)
+            {
+                limitVertices[vertexIndex] = vertexEdges[vertexIndex] == NO_INDEX ? vertices[vertexIndex] : getLimitVertex(vertexIndex);
+            }
+        });
+        std::swap(vertices, limitVertices);
+
+        // flat shading still wants the faces of the projected mesh
+        parallelFor(faceNormals.size(), [&](U32 begin, U32 end) {
+            for (U32 faceIndex = begin; faceIndex < end; faceIndex += 1)
+            {
+                V3 position1 = vertices[indices[faceIndex * 3 + 0]].position;
+                V3 position2 = vertices[indices[faceIndex * 3 + 1]].position;
+                V3 position3 = vertices[indices[faceIndex * 3 + 2]].position;
+
+                V3  areaNormal = cross(position1 - position2, position1 - position3);
+                F32 doubleArea = length(areaNormal);
+                faceNormals[faceIndex] = 0 < doubleArea ? areaNormal * (1 / doubleArea) : V3();
+            }
+        });
     }
 
-    U32 getDegree(Vertex& vertex)
+    Vertex getLimitVertex(U32 vertex)
     {
-        U32   degree = 1;
-        Edge* startingEdge = vertex.edge;
-        Edge* currentEdge = startingEdge->symmetric->next;
-        while (!(startingEdge->end->position == currentEdge->end->position))
+        Vertex limit = vertices[vertex];
+        V3     position = limit.position;
+
+        U32 degree = 0;
+        V3  faceNormalSum;
+        U32 incomingBorderEdge = forEachOutgoingEdge(vertex, [&](U32 edge) {
+            degree += 1;
+            faceNormalSum = faceNormalSum + faceNormals[edge / 3];
+        });
+
+        V3 tangent1, tangent2;
+        if (incomingBorderEdge == NO_INDEX)
+        {
+            // the n neighbours in order round the vertex, weighted by cos and sin of 2 pi i / n
+            F32 limitWeight = 1 / (3 / (8 * getLoopWeight(degree)) + degree);
+            F32 stepCos = cos(2 * PI / degree), stepSin = sin(2 * PI / degree);
+            F32 angleCos = 1, angleSin = 0;
+
+            V3  neighbourSum;
+            U32 edge = vertexEdges[vertex];
+            for (U32 neighbour = 0; neighbour < degree; neighbour += 1)
+            {
+                V3 neighbourPosition = vertices[indices[getNextEdge(edge)]].position;
+                neighbourSum = neighbourSum + neighbourPosition;
+                tangent1 = tangent1 + neighbourPosition * angleCos;
+                tangent2 = tangent2 + neighbourPosition * angleSin;
+
+                F32 nextCos = angleCos * stepCos - angleSin * stepSin;
+                angleSin = angleSin * stepCos + angleCos * stepSin;
+                angleCos = nextCos;
+                edge = getNextEdge(symmetricEdges[edge]);
+            }
+            limit.position = position * (1 - degree * limitWeight) + neighbourSum * limitWeight;
+        }
+        else
+        {
+            // neighbours r0 to rk of k faces, from the start of the incoming border
+            // edge round to the end of the outgoing one
+            U32        faces = degree;
+            const F32* acrossWeights = getBoundaryTangentWeights(faces);
+            V3         firstPosition = vertices[indices[incomingBorderEdge]].position;
+            V3         lastPosition;
+            tangent2 = position * acrossWeights[0] + firstPosition * acrossWeights[1];
+
+            U32 edge = getNextEdge(incomingBorderEdge);
+            for (U32 neighbour = 1; neighbour <= faces; neighbour += 1)
+            {
+                V3 neighbourPosition = vertices[indices[getNextEdge(edge)]].position;
+                tangent2 = tangent2 + neighbourPosition * acrossWeights[neighbour + 1];
+                if (neighbour == faces)
+                {
+                    lastPosition = neighbourPosition;
+                    break;
+                }
+                edge = getNextEdge(symmetricEdges[edge]);
+            }
+
+            tangent1 = firstPosition - lastPosition;
+            limit.position = (firstPosition + position * 4 + lastPosition) / 6;
+        }
+
+        // the masks fix the normal's direction but not which way round it points
+        V3  normal = cross(tangent1, tangent2);
+        F32 normalLength = length(normal);
+        if (normalLength == 0) normal = faceNormalSum, normalLength = length(normal);
+        if (dot(normal, faceNormalSum) < 0) normalLength = -normalLength;
+        limit.normal = normalLength == 0 ? V3() : normal * (1 / normalLength);
+        return limit;
+    }
+
+    // Red-green refinement. The faces shouldSplit(face) selects split into four
+    // like refine(); a neighbour left with one split edge is halved across it,
+    // so the result has no cracks or T-junctions, and one with two split edges
+    // is split into four as well. Old vertices follow Loop's even rule where
+    // every edge around them is split and stay put elsewhere, so the parts of
+    // the surface that are not refined do not move.
+    template <typename F>
+    void refineAdaptive(F shouldSplit)
+    {
+        U32 verticesLength = vertices.size();
+        U32 facesLength = indices.size() / 3;
+        U32 edgesLength = facesLength * 3;
+
+        arena.reset();
+        U8*  isFaceSelected = arena.allocate<U8>(facesLength);
+        U8*  isEdgeSplit = arena.allocate<U8>(edgesLength);
+        U32* oddVertices = arena.allocate<U32>(edgesLength);
+        U32* faceOffsets = arena.allocate<U32>(facesLength + 1);
+
+        parallelFor(facesLength, [&](U32 begin, U32 end) {
+            for (U32 faceIndex = begin; faceIndex < end; faceIndex += 1)
+            {
+                isFaceSelected[faceIndex] = shouldSplit(faceIndex);
+            }
+        });
+
+        // both halves of an edge split if either face asks for it
+        parallelFor(edgesLength, [&](U32 begin, U32 end) {
+            for (U32 edgeIndex = begin; edgeIndex < end; edgeIndex += 1)
+            {
+                U32 symmetricEdge = symmetricEdges[edgeIndex];
+                isEdgeSplit[edgeIndex] = isFaceSelected[edgeIndex / 3] || (symmetricEdge != NO_INDEX && isFaceSelected[symmetricEdge / 3]);
+            }
+        });
+
+        // splitting the third edge of a face with two can give a neighbour its
+        // second, so repeat until no face is left with two
+        for (bool isChanged = true; isChanged;)
+        {
+            isChanged = false;
+            for (U32 faceIndex = 0; faceIndex < facesLength; faceIndex += 1)
+            {
+                if (getSplitEdgesLength(isEdgeSplit, faceIndex) != 2) continue;
+                for (U32 edgeIndex = faceIndex * 3; edgeIndex < faceIndex * 3 + 3; edgeIndex += 1)
+                {
+                    isEdgeSplit[edgeIndex] = 1;
+                    if (symmetricEdges[edgeIndex] != NO_INDEX) isEdgeSplit[symmetricEdges[edgeIndex]] = 1;
+                }
+                isChanged = true;
+            }
+        }
+
+        U32 oddVerticesLength = parallelCompact(
+            edgesLength, [&](U32 edgeIndex) { return isEdgeSplit[edgeIndex] && isOddVertexOwner(edgeIndex); },
+            [&](U32 edgeIndex, U32 number) { oddVertices[edgeIndex] = verticesLength + number; });
+        parallelFor(edgesLength, [&](U32 begin, U32 end) {
+            for (U32 edgeIndex = begin; edgeIndex < end; edgeIndex += 1)
+            {
+                if (isEdgeSplit[edgeIndex] && !isOddVertexOwner(edgeIndex)) oddVertices[edgeIndex] = oddVertices[symmetricEdges[edgeIndex]];
+            }
+        });
+
+        // a face becomes four faces with three split edges, two with one
+        faceOffsets[0] = 0;
+        for (U32 faceIndex = 0; faceIndex < facesLength; faceIndex += 1)
         {
-            degree++;
-            currentEdge = currentEdge->symmetric->next;
+            U32 splitEdgesLength = getSplitEdgesLength(isEdgeSplit, faceIndex);
+            faceOffsets[faceIndex + 1] = faceOffsets[faceIndex] + (splitEdgesLength == 3 ? 4 : splitEdgesLength + 1);
         }
-        return degree;
+
+        std::vector<Vertex>& newVertices = spareVertices;
+        std::vector<U32>&    newIndices = spareIndices;
+        newVertices.resize(verticesLength + oddVerticesLength);
+        newIndices.resize(faceOffsets[facesLength] * 3);
+
+        parallelFor(verticesLength, [&](U32 begin, U32 end) {
+            for (U32 vertexIndex = begin; vertexIndex < end; vertexIndex += 1)
+            {
+                bool isRefined = vertexEdges[vertexIndex] != NO_INDEX;
+                if (isRefined)
+                {
+                    U32 incomingBorderEdge = forEachOutgoingEdge(vertexIndex, [&](U32 edge) { isRefined = isRefined && isEdgeSplit[edge]; });
+                    isRefined = isRefined && (incomingBorderEdge == NO_INDEX || isEdgeSplit[incomingBorderEdge]);
+                }
+                newVertices[vertexIndex] = Vertex(isRefined ? getEvenPosition(vertexIndex) : vertices[vertexIndex].position);
+            }
+        });
+        parallelFor(edgesLength, [&](U32 begin, U32 end) {
+            for (U32 edgeIndex = begin; edgeIndex < end; edgeIndex += 1)
+            {
+                if (isEdgeSplit[edgeIndex] && isOddVertexOwner(edgeIndex)) newVertices[oddVertices[edgeIndex]] = Vertex(getOddPosition(edgeIndex));
+            }
+        });
+
+        parallelFor(facesLength, [&](U32 begin, U32 end) {
+            for (U32 faceIndex = begin; faceIndex < end; faceIndex += 1)
+            {
+                U32* faceIndices = &newIndices[faceOffsets[faceIndex] * 3];
+                U32* corners = &indices[faceIndex * 3];
+                U32* odds = &oddVertices[faceIndex * 3];
+
+                U32 splitEdgesLength = getSplitEdgesLength(isEdgeSplit, faceIndex);
+                if (splitEdgesLength == 0)
+                {
+                    faceIndices[0] = corners[0], faceIndices[1] = corners[1], faceIndices[2] = corners[2];
+                }
+                else if (splitEdgesLength == 3)
+                {
+                    faceIndices[0] = corners[0], faceIndices[1] = odds[0], faceIndices[2] = odds[2];
+                    faceIndices[3] = corners[1], faceIndices[4] = odds[1], faceIndices[5] = odds[0];
+                    faceIndices[6] = corners[2], faceIndices[7] = odds[2], faceIndices[8] = odds[1];
+                    faceIndices[9] = odds[0], faceIndices[10] = odds[1], faceIndices[11] = odds[2];
+                }
+                else
+                {
+                    // halved from the odd vertex to the opposite corner
+                    U32 corner = isEdgeSplit[faceIndex * 3 + 0] ? 0 : isEdgeSplit[faceIndex * 3 + 1] ? 1 : 2;
+                    U32 startVertex = corners[corner], endVertex = corners[(corner + 1) % 3], oppositeVertex = corners[(corner + 2) % 3];
+                    faceIndices[0] = startVertex, faceIndices[1] = odds[corner], faceIndices[2] = oppositeVertex;
+                    faceIndices[3] = odds[corner], faceIndices[4] = endVertex, faceIndices[5] = oppositeVertex;
+                }
+            }
+        });
+
+        std::swap(vertices, newVertices);
+        std::swap(indices, newIndices);
+
+        // the faces no longer follow refine()'s numbering, so the symmetric edges are matched again
+        createWingedEdgeMesh();
+        optimizeOrder();
+    }
+
+    U32 getSplitEdgesLength(const U8* isEdgeSplit, U32 face)
+    {
+        return isEdgeSplit[face * 3 + 0] + isEdgeSplit[face * 3 + 1] + isEdgeSplit[face * 3 + 2];
     }
 
-    V3 sumNeighbours(Vertex& vertex)
+    // largest angle in radians between the normal of face and those of its neighbours
+    F32 getFaceCurvature(U32 face)
     {
-        V3    sum = vertex.edge->end->position;
-        Edge* startingEdge = vertex.edge;
-        Edge* currentEdge = startingEdge->symmetric->next;
-        U32   i = 0;
-        while (!(startingEdge->end->position == currentEdge->end->position))
+        V3  normal = faceNormals[face];
+        F32 smallestCos = 1;
+        for (U32 edgeIndex = face * 3; edgeIndex < face * 3 + 3; edgeIndex += 1)
         {
-            i++;
-            sum = sum + currentEdge->end->position;
-            currentEdge = currentEdge->symmetric->next;
+            if (symmetricEdges[edgeIndex] == NO_INDEX) continue;
+            smallestCos = std::min(smallestCos, dot(normal, faceNormals[symmetricEdges[edgeIndex] / 3]));
         }
-        return sum;
+        return acos(std::max(-1.0f, smallestCos));
     }
 
-    void subdivide()
+    // Longest edge of face in pixels on a viewport of width by height pixels,
+    // as clipFromObject projects it. 0 for faces that are not in view.
+    F32 getProjectedEdgeLength(U32 face, M4 clipFromObject, F32 width, F32 height)
     {
-        std::unordered_map<std::string, U32> vertexIndexMap;
+        V2  points[3];
+        U32 outsideX = 0, outsideY = 0;
+        for (U32 corner = 0; corner < 3; corner += 1)
+        {
+            V4 clip = V4(vertices[indices[face * 3 + corner]].position, 1) * clipFromObject;
+            if (clip.w <= 0) return 0;  // behind the eye
 
-        U32  oldVertexCount = vertices.size();
-        auto newVertices = std::vector<Vertex>(vertices);
-        auto newIndices = std::vector<U32>();
+            points[corner] = V2(clip.x / clip.w * width / 2, clip.y / clip.w * height / 2);
+            outsideX |= clip.x < -clip.w ? 1 : clip.w < clip.x ? 2 : 4;
+            outsideY |= clip.y < -clip.w ? 1 : clip.w < clip.y ? 2 : 4;
+        }
+        if (outsideX == 1 || outsideX == 2 || outsideY == 1 || outsideY == 2) return 0;  // all corners past one side
 
-        for (U32 faceIndex = 0; faceIndex * 3 < indices.size(); faceIndex += 1)
+        F32 longest = 0;
+        for (U32 corner = 0; corner < 3; corner += 1)
         {
-            Face* face = &faces[faceIndex];
+            longest = std::max(longest, length(points[corner] - points[(corner + 1) % 3]));
+        }
+        return longest;
+    }
 
-            Edge* edge1 = face->edge;
-            Edge* edge2 = face->edge->next;
-            Edge* edge3 = face->edge->next->next;
+    // of the two halves of an edge, the lower numbered one numbers its odd vertex
+    bool isOddVertexOwner(U32 edge)
+    {
+        return symmetricEdges[edge] == NO_INDEX || edge < symmetricEdges[edge];
+    }
 
-            Vertex* vertex1 = edge1->start;
-            U32     vertexIndex1 = indices[faceIndex * 3 + 0];
+    // Quadric error metric simplification (Garland and Heckbert 1997): edge
+    // collapses on the half-edge arrays, cheapest first, until at most
+    // targetFacesLength faces are left or nothing more can collapse without
+    // tearing or folding the surface. Every vertex carries the quadric of the
+    // planes of its faces, and open boundaries heavy planes across them so they
+    // stay put. The queue is updated lazily: a collapse queues nothing, and an
+    // edge popped with a cost that has since gone up is queued again at the
+    // new cost instead of collapsing.
+    void simplify(U32 targetFacesLength)
+    {
+        U32 verticesLength = vertices.size();
+        U32 facesLength = indices.size() / 3;
+        if (facesLength <= targetFacesLength) return;
+
+        arena.reset();
+        Quadric* quadrics = arena.allocate<Quadric>(verticesLength);
+        U32*     marks = arena.allocate<U32>(verticesLength);
+        U32*     faceCounts = arena.allocate<U32>(verticesLength);
+        U8*      isVertexLocked = arena.allocate<U8>(verticesLength);
+        U8*      isFaceRemoved = arena.allocate<U8>(facesLength);
+        std::fill(faceCounts, faceCounts + verticesLength, 0);
+        std::fill(isFaceRemoved, isFaceRemoved + facesLength, 0);
+        for (U32 corner = 0; corner < facesLength * 3; corner += 1)
+        {
+            faceCounts[indices[corner]] += 1;
+        }
 
-            Vertex* vertex2 = edge2->start;
-            U32     vertexIndex2 = indices[faceIndex * 3 + 1];
+        parallelFor(verticesLength, [&](U32 begin, U32 end) {
+            for (U32 vertexIndex = begin; vertexIndex < end; vertexIndex += 1)
+            {
+                quadrics[vertexIndex] = Quadric();
+                marks[vertexIndex] = 0;
+                if (vertexEdges[vertexIndex] == NO_INDEX)
+                {
+                    isVertexLocked[vertexIndex] = 1;
+                    continue;
+                }
 
-            Vertex* vertex3 = edge3->start;
-            U32     vertexIndex3 = indices[faceIndex * 3 + 2];
+                U32 fanFaces = 0;
+                U32 incomingBorderEdge = forEachOutgoingEdge(vertexIndex, [&](U32 edge) {
+                    fanFaces += 1;
+                    quadrics[vertexIndex].add(getFaceQuadric(edge / 3));
+                    if (symmetricEdges[edge] == NO_INDEX) quadrics[vertexIndex].add(getBorderQuadric(edge));
+                });
+                if (incomingBorderEdge != NO_INDEX) quadrics[vertexIndex].add(getBorderQuadric(incomingBorderEdge));
 
-            V3 oppositePosition;
-            V3 position;
+                // faces the fan does not reach meet here without sharing an edge, which collapses would tear
+                isVertexLocked[vertexIndex] = fanFaces != faceCounts[vertexIndex];
+            }
+        });
 
-            // new vertex 1
-            U32 newVertexIndex1;
-            oppositePosition = edge1->symmetric->next->end->position;
-            position = vertex1->position * 3 / 8 + vertex2->position * 3 / 8 + vertex3->position * 1 / 8 + oppositePosition * 1 / 8;
-            if (vertexIndexMap.count(position.string()) == 0)
+        // one entry per edge to start with, as a min-heap on the cost. Four
+        // children to a node, so a pop touches half the levels of a binary
+        // heap and each node's children share a cache line
+        struct Candidate
+        {
+            F32 cost;
+            U32 edge;
+        };
+
+        U32  edgesLength = facesLength * 3;
+        U32* ownedEdges = arena.allocate<U32>(edgesLength);
+        U32  candidatesLength = parallelCompact(
+            edgesLength, [&](U32 edge) { return isOddVertexOwner(edge); }, [&](U32 edge, U32 number) { ownedEdges[number] = edge; });
+        std::vector<Candidate> heap(candidatesLength);
+        parallelFor(candidatesLength, [&](U32 begin, U32 end) {
+            for (U32 number = begin; number < end; number += 1)
             {
-                newVertexIndex1 = newVertices.size();
-                newVertices.push_back(Vertex(position));
-                vertexIndexMap[position.string()] = newVertexIndex1;
+                U32 edge = ownedEdges[number];
+                V3  target;
+                heap[number] = {getCollapseTarget(quadrics, indices[edge], indices[getNextEdge(edge)], target), edge};
             }
-            else
+        });
+
+        auto siftDown = [&](U32 slot) {
+            Candidate moved = heap[slot];
+            U32       heapLength = heap.size();
+            while (slot * 4 + 1 < heapLength)
+            {
+                U32 firstChild = slot * 4 + 1;
+                U32 lastChild = std::min(firstChild + 4, heapLength);
+                U32 cheapest = firstChild;
+                for (U32 child = firstChild + 1; child < lastChild; child += 1)
+                {
+                    if (heap[child].cost < heap[cheapest].cost) cheapest = child;
+                }
+                if (!(heap[cheapest].cost < moved.cost)) break;
+                heap[slot] = heap[cheapest];
+                slot = cheapest;
+            }
+            heap[slot] = moved;
+        };
+        auto siftUp = [&](U32 slot) {
+            Candidate moved = heap[slot];
+            while (slot > 0 && moved.cost < heap[(slot - 1) / 4].cost)
             {
-                newVertexIndex1 = vertexIndexMap[position.string()];
+                heap[slot] = heap[(slot - 1) / 4];
+                slot = (slot - 1) / 4;
             }
+            heap[slot] = moved;
+        };
+        for (U32 slot = candidatesLength / 4 + 1; slot > 0; slot -= 1)
+        {
+            if (slot - 1 < candidatesLength) siftDown(slot - 1);
+        }
 
-            // new vertex 2
-            U32 newVertexIndex2;
-            oppositePosition = edge2->symmetric->next->end->position;
-            position = vertex2->position * 3 / 8 + vertex3->position * 3 / 8 + vertex1->position * 1 / 8 + oppositePosition * 1 / 8;
-            if (vertexIndexMap.count(position.string()) == 0)
+        // entries of removed faces are dropped, and two edges merged by a
+        // collapse keep both their entries, which only costs a second look
+        U32 liveFacesLength = facesLength;
+        U32 mark = 0;
+        while (targetFacesLength < liveFacesLength && !heap.empty())
+        {
+            Candidate candidate = heap[0];
+            heap[0] = heap.back();
+            heap.pop_back();
+            if (!heap.empty()) siftDown(0);
+
+            U32 edge = candidate.edge;
+            if (isFaceRemoved[edge / 3]) continue;
+            U32 start = indices[edge], end = indices[getNextEdge(edge)];
+            if (isVertexLocked[start] || isVertexLocked[end]) continue;
+
+            V3  target;
+            F32 cost = getCollapseTarget(quadrics, start, end, target);
+            if (candidate.cost < cost)
             {
-                newVertexIndex2 = newVertices.size();
-                newVertices.push_back(Vertex(position));
-                vertexIndexMap[position.string()] = newVertexIndex2;
+                heap.push_back({cost, edge});
+                siftUp(heap.size() - 1);
+                continue;
             }
-            else
+
+            mark += 1;
+            if (!canCollapse(edge, target, marks, mark)) continue;
+
+            liveFacesLength -= collapseEdge(edge, target, isFaceRemoved);
+            quadrics[start].add(quadrics[end]);
+        }
+
+        // keep the faces and vertices that are left, in their old order
+        U32* newVertices = arena.allocate<U32>(verticesLength);
+        U32  newVerticesLength = 0;
+        for (U32 vertexIndex = 0; vertexIndex < verticesLength; vertexIndex += 1)
+        {
+            bool isUsed = vertexEdges[vertexIndex] != NO_INDEX;
+            newVertices[vertexIndex] = isUsed ? newVerticesLength++ : NO_INDEX;
+            if (isUsed) vertices[newVertices[vertexIndex]] = vertices[vertexIndex];
+        }
+        vertices.resize(newVerticesLength);
+
+        U32 newIndicesLength = 0;
+        for (U32 faceIndex = 0; faceIndex < facesLength; faceIndex += 1)
+        {
+            if (isFaceRemoved[faceIndex]) continue;
+            for (U32 corner = faceIndex * 3; corner < faceIndex * 3 + 3; corner += 1)
             {
-                newVertexIndex2 = vertexIndexMap[position.string()];
+                indices[newIndicesLength++] = newVertices[indices[corner]];
             }
+        }
+        indices.resize(newIndicesLength);
 
-            // new vertex 3
-            U32 newVertexIndex3;
-            oppositePosition = edge3->symmetric->next->end->position;
-            position = vertex3->position * 3 / 8 + vertex1->position * 3 / 8 + vertex2->position * 1 / 8 + oppositePosition * 1 / 8;
-            if (vertexIndexMap.count(position.string()) == 0)
+        createWingedEdgeMesh();
+        optimizeOrder();
+    }
+
+    // area weighted plane of face
+    Quadric getFaceQuadric(U32 face)
+    {
+        V3 position1 = vertices[indices[face * 3 + 0]].position;
+        V3 position2 = vertices[indices[face * 3 + 1]].position;
+        V3 position3 = vertices[indices[face * 3 + 2]].position;
+
+        V3  areaNormal = cross(position1 - position2, position1 - position3);
+        F32 doubleArea = length(areaNormal);
+        if (doubleArea == 0) return Quadric();
+        return getPlaneQuadric(areaNormal * (1 / doubleArea), position1, doubleArea / 2);
+    }
+
+    // plane through an open boundary edge, square to its face, weighted
+    // heavily so that simplifying does not eat the boundary away
+    Quadric getBorderQuadric(U32 edge)
+    {
+        const F64 BORDER_WEIGHT = 10;
+
+        V3 startPosition = vertices[indices[edge]].position;
+        V3 endPosition = vertices[indices[getNextEdge(edge)]].position;
+        V3 farPosition = vertices[indices[getPreviousEdge(edge)]].position;
+
+        V3  along = endPosition - startPosition;
+        V3  across = cross(along, cross(startPosition - endPosition, startPosition - farPosition));
+        F32 acrossLength = length(across);
+        if (acrossLength == 0) return Quadric();
+        return getPlaneQuadric(across * (1 / acrossLength), startPosition, BORDER_WEIGHT * dot(along, along));
+    }
+
+    // Where collapsing start and end leaves their vertex: the minimum of the
+    // summed quadric if there is a sensible one, else the best of the two
+    // ends and their midpoint. Returns the error there.
+    F32 getCollapseTarget(const Quadric* quadrics, U32 start, U32 end, V3& target)
+    {
+        Quadric quadric = quadrics[start];
+        quadric.add(quadrics[end]);
+
+        V3 startPosition = vertices[start].position;
+        V3 endPosition = vertices[end].position;
+        V3 midpoint = (startPosition + endPosition) / 2;
+
+        // a minimum far from the edge comes from a nearly flat quadric and is not worth having
+        V3 minimum;
+        if (quadric.getMinimum(minimum))
+        {
+            V3 fromMidpoint = minimum - midpoint;
+            V3 edgeVector = endPosition - startPosition;
+            if (dot(fromMidpoint, fromMidpoint) <= 4 * dot(edgeVector, edgeVector))
             {
-                newVertexIndex3 = newVertices.size();
-                newVertices.push_back(Vertex(position));
-                vertexIndexMap[position.string()] = newVertexIndex3;
+                target = minimum;
+                return quadric.getError(minimum);
             }
-            else
+        }
+
+        F64 startError = quadric.getError(startPosition);
+        F64 endError = quadric.getError(endPosition);
+        F64 midpointError = quadric.getError(midpoint);
+        if (midpointError <= startError && midpointError <= endError)
+        {
+            target = midpoint;
+            return midpointError;
+        }
+        target = startError <= endError ? startPosition : endPosition;
+        return std::min(startError, endError);
+    }
+
+    // Whether edge can collapse to target and leave a manifold surface with
+    // no face turned over. The two ends may share no neighbours but the far
+    // corners of the faces on the edge (the link condition), an inner edge
+    // may not join two boundaries, and no face that survives may flip.
+    bool canCollapse(U32 edge, V3 target, U32* marks, U32 mark)
+    {
+        U32 start = indices[edge], end = indices[getNextEdge(edge)];
+        U32 symmetricEdge = symmetricEdges[edge];
+        U32 left = indices[getPreviousEdge(edge)];
+        U32 right = symmetricEdge == NO_INDEX ? NO_INDEX : indices[getPreviousEdge(symmetricEdge)];
+        if (left == right) return false;
+
+        // a removed face must leave its far corner an edge to hang on to
+        if (symmetricEdges[getNextEdge(edge)] == NO_INDEX && symmetricEdges[getPreviousEdge(edge)] == NO_INDEX) return false;
+        if (symmetricEdge != NO_INDEX && symmetricEdges[getNextEdge(symmetricEdge)] == NO_INDEX && symmetricEdges[getPreviousEdge(symmetricEdge)] == NO_INDEX) return false;
+
+        // nor leave it a closed fan of two faces, which lie on top of each other
+        auto isClosedFanOfThree = [&](U32 corner) {
+            U32 fanFaces = 0;
+            U32 incomingBorderEdge = forEachOutgoingEdge(corner, [&](U32) { fanFaces += 1; });
+            return incomingBorderEdge == NO_INDEX && fanFaces == 3;
+        };
+        if (isClosedFanOfThree(left) || (right != NO_INDEX && isClosedFanOfThree(right))) return false;
+
+        // every other face around either end, with that end moved to target
+        bool isFlipped = false;
+        auto checkFace = [&](U32 vertex, U32 outgoingEdge) {
+            U32 face = outgoingEdge / 3;
+            if (face == edge / 3 || (symmetricEdge != NO_INDEX && face == symmetricEdge / 3)) return;
+
+            V3 position = vertices[vertex].position;
+            V3 nextPosition = vertices[indices[getNextEdge(outgoingEdge)]].position;
+            V3 previousPosition = vertices[indices[getPreviousEdge(outgoingEdge)]].position;
+            V3 oldNormal = cross(nextPosition - position, previousPosition - position);
+            V3 newNormal = cross(nextPosition - target, previousPosition - target);
+            if (dot(oldNormal, newNormal) <= 0) isFlipped = true;
+        };
+
+        U32 startBorderEdge = forEachOutgoingEdge(start, [&](U32 outgoingEdge) {
+            marks[indices[getNextEdge(outgoingEdge)]] = mark;
+            checkFace(start, outgoingEdge);
+        });
+        if (startBorderEdge != NO_INDEX) marks[indices[startBorderEdge]] = mark;
+
+        bool isShared = false;
+        U32  endBorderEdge = forEachOutgoingEdge(end, [&](U32 outgoingEdge) {
+            U32 neighbour = indices[getNextEdge(outgoingEdge)];
+            if (marks[neighbour] == mark && neighbour != left && neighbour != right) isShared = true;
+            checkFace(end, outgoingEdge);
+        });
+        if (endBorderEdge != NO_INDEX)
+        {
+            U32 neighbour = indices[endBorderEdge];
+            if (marks[neighbour] == mark && neighbour != left && neighbour != right) isShared = true;
+        }
+        if (symmetricEdge != NO_INDEX && startBorderEdge != NO_INDEX && endBorderEdge != NO_INDEX) return false;
+        return !isShared && !isFlipped;
+    }
+
+    // Merges the end of edge into its start, moved to target, removing the
+    // one or two faces on the edge. Returns how many faces went.
+    U32 collapseEdge(U32 edge, V3 target, U8* isFaceRemoved)
+    {
+        U32 start = indices[edge], end = indices[getNextEdge(edge)];
+        U32 symmetricEdge = symmetricEdges[edge];
+
+        // an edge the kept vertex still has afterwards
+        U32 keptEdge = NO_INDEX;
+        auto findKeptEdge = [&](U32 outgoingEdge) {
+            U32 face = outgoingEdge / 3;
+            if (keptEdge == NO_INDEX && face != edge / 3 && (symmetricEdge == NO_INDEX || face != symmetricEdge / 3)) keptEdge = outgoingEdge;
+        };
+        forEachOutgoingEdge(start, findKeptEdge);
+        forEachOutgoingEdge(end, [&](U32 outgoingEdge) {
+            findKeptEdge(outgoingEdge);
+            indices[outgoingEdge] = start;
+        });
+
+        removeCollapsedFace(edge, isFaceRemoved);
+        if (symmetricEdge != NO_INDEX) removeCollapsedFace(symmetricEdge, isFaceRemoved);
+
+        vertices[start].position = target;
+        vertexEdges[start] = keptEdge;
+        vertexEdges[end] = NO_INDEX;
+        return symmetricEdge == NO_INDEX ? 1 : 2;
+    }
+
+    // the face of a collapsing edge: its two other edges' neighbours become
+    // each other's, and its far corner moves to an edge that stays
+    void removeCollapsedFace(U32 edge, U8* isFaceRemoved)
+    {
+        U32 nextEdge = getNextEdge(edge), previousEdge = getPreviousEdge(edge);
+        U32 nextSymmetricEdge = symmetricEdges[nextEdge], previousSymmetricEdge = symmetricEdges[previousEdge];
+        if (nextSymmetricEdge != NO_INDEX) symmetricEdges[nextSymmetricEdge] = previousSymmetricEdge;
+        if (previousSymmetricEdge != NO_INDEX) symmetricEdges[previousSymmetricEdge] = nextSymmetricEdge;
+
+        U32 farVertex = indices[previousEdge];
+        if (vertexEdges[farVertex] == previousEdge)
+        {
+            vertexEdges[farVertex] = nextSymmetricEdge != NO_INDEX ? nextSymmetricEdge : getNextEdge(previousSymmetricEdge);
+        }
+        isFaceRemoved[edge / 3] = 1;
+    }
+
+    // Fills levels with simplified copies of this mesh, level i with about
+    // ratios[i] of its faces. Each level is simplified from the one before, so
+    // the whole chain costs little more than its first level, at the price
+    // of quadrics that only remember the level before and not the original.
+    void createLevelsOfDetail(const std::vector<F32>& ratios, std::vector<WingedEdgeMesh>& levels)
+    {
+        U32 facesLength = indices.size() / 3;
+        levels.resize(ratios.size());
+        const WingedEdgeMesh* source = this;
+        for (U32 level = 0; level < ratios.size(); level += 1)
+        {
+            levels[level].copyMesh(*source);
+            levels[level].simplify(facesLength * ratios[level]);
+            source = &levels[level];
+        }
+    }
+
+    // the surface of other, without its buffers or stencils
+    void copyMesh(const WingedEdgeMesh& other)
+    {
+        vertices = other.vertices;
+        indices = other.indices;
+        symmetricEdges = other.symmetricEdges;
+        vertexEdges = other.vertexEdges;
+        faceNormals = other.faceNormals;
+        normalWeighting = other.normalWeighting;
+        isOverdrawOrdered = other.isOverdrawOrdered;
+        meshlets = other.meshlets;
+        controlPositions.clear();
+        stencilTables.clear();
+    }
+
+    // Subdivides levels times and records every level as a StencilTable, for
+    // meshes whose vertices move while their connectivity stays the same:
+    // evaluateStencilTables() then refines new control positions without any
+    // of the connectivity work subdivide() does.
+    void createStencilTables(U32 levels)
+    {
+        controlPositions.resize(vertices.size());
+        for (U32 vertexIndex = 0; vertexIndex < vertices.size(); vertexIndex += 1)
+        {
+            controlPositions[vertexIndex] = vertices[vertexIndex].position;
+        }
+
+        stencilTables.resize(levels);
+        for (U32 level = 0; level < levels; level += 1)
+        {
+            createStencilTable(stencilTables[level]);
+            refine();
+        }
+        computeNormals(normalWeighting);
+        optimizeOrder();
+    }
+
+    // the weights refine() applies to the current vertices, one row per
+    // refined vertex in the order refine() numbers them
+    void createStencilTable(StencilTable& table)
+    {
+        U32 verticesLength = vertices.size();
+        U32 edgesLength = indices.size();
+
+        arena.reset();
+        U32* oddEdges = arena.allocate<U32>(edgesLength);
+        U32  oddVerticesLength = parallelCompact(
+            edgesLength, [&](U32 edgeIndex) { return isOddVertexOwner(edgeIndex); },
+            [&](U32 edgeIndex, U32 number) { oddEdges[number] = edgeIndex; });
+
+        U32 rowsLength = verticesLength + oddVerticesLength;
+        table.offsets.resize(rowsLength + 1);
+        table.offsets[0] = 0;
+        parallelFor(rowsLength, [&](U32 begin, U32 end) {
+            for (U32 row = begin; row < end; row += 1)
             {
-                newVertexIndex3 = vertexIndexMap[position.string()];
+                table.offsets[row + 1] = row < verticesLength ? getEvenStencilLength(row) : getOddStencilLength(oddEdges[row - verticesLength]);
             }
+        });
+        for (U32 row = 0; row < rowsLength; row += 1)
+        {
+            table.offsets[row + 1] += table.offsets[row];
+        }
 
-            // face 1
-            newIndices.push_back(vertexIndex1);
-            newIndices.push_back(newVertexIndex1);
-            newIndices.push_back(newVertexIndex3);
+        table.sources.resize(table.offsets[rowsLength]);
+        table.weights.resize(table.offsets[rowsLength]);
+        parallelFor(rowsLength, [&](U32 begin, U32 end) {
+            for (U32 row = begin; row < end; row += 1)
+            {
+                U32* sources = &table.sources[table.offsets[row]];
+                F32* weights = &table.weights[table.offsets[row]];
+                if (row < verticesLength)
+                {
+                    writeEvenStencil(row, sources, weights);
+                }
+                else
+                {
+                    writeOddStencil(oddEdges[row - verticesLength], sources, weights);
+                }
+            }
+        });
+    }
 
-            // face 2
-            newIndices.push_back(vertexIndex2);
-            newIndices.push_back(newVertexIndex2);
-            newIndices.push_back(newVertexIndex1);
+    U32 getEvenStencilLength(U32 vertex)
+    {
+        if (vertexEdges[vertex] == NO_INDEX) return 1;
 
-            // face 3
-            newIndices.push_back(vertexIndex3);
-            newIndices.push_back(newVertexIndex3);
-            newIndices.push_back(newVertexIndex2);
+        U32 degree = 0;
+        U32 incomingBorderEdge = forEachOutgoingEdge(vertex, [&](U32) { degree += 1; });
+        return incomingBorderEdge == NO_INDEX ? degree + 1 : 3;
+    }
 
-            // face 4 (center)
-            newIndices.push_back(newVertexIndex1);
-            newIndices.push_back(newVertexIndex2);
-            newIndices.push_back(newVertexIndex3);
+    // getEvenPosition() as weights, the vertex itself first
+    void writeEvenStencil(U32 vertex, U32* sources, F32* weights)
+    {
+        sources[0] = vertex;
+        weights[0] = 1;
+        if (vertexEdges[vertex] == NO_INDEX) return;
+
+        U32 degree = 0;
+        U32 outgoingBorderEdge = NO_INDEX;
+        U32 incomingBorderEdge = forEachOutgoingEdge(vertex, [&](U32 edge) {
+            degree += 1;
+            if (symmetricEdges[edge] == NO_INDEX) outgoingBorderEdge = edge;
+        });
+
+        if (incomingBorderEdge != NO_INDEX)
+        {
+            sources[1] = indices[incomingBorderEdge];
+            sources[2] = indices[getNextEdge(outgoingBorderEdge)];
+            weights[0] = 3.0f / 4.0f;
+            weights[1] = weights[2] = 1.0f / 8.0f;
+            return;
         }
 
-        indices = newIndices;
-        vertices = newVertices;
+        F32 weight = getLoopWeight(degree);
+        weights[0] = 1 - weight * degree;
+        U32 neighbour = 1;
+        forEachOutgoingEdge(vertex, [&](U32 edge) {
+            sources[neighbour] = indices[getNextEdge(edge)];
+            weights[neighbour] = weight;
+            neighbour += 1;
+        });
+    }
 
-        createWingedEdgeMesh();
+    U32 getOddStencilLength(U32 edge)
+    {
+        return symmetricEdges[edge] == NO_INDEX ? 2 : 4;
+    }
 
-        // loop through all even vertices (old ones)
-        for (U32 vertexIndex = 0; vertexIndex < oldVertexCount; vertexIndex += 1)
+    // getOddPosition() as weights
+    void writeOddStencil(U32 edge, U32* sources, F32* weights)
+    {
+        sources[0] = indices[edge];
+        sources[1] = indices[getNextEdge(edge)];
+        if (symmetricEdges[edge] == NO_INDEX)
         {
-            Vertex* vertex = &vertices[vertexIndex];
-            F32     degree = getDegree(*vertex);
+            weights[0] = weights[1] = 1.0f / 2.0f;
+            return;
+        }
+
+        sources[2] = indices[getPreviousEdge(edge)];
+        sources[3] = indices[getPreviousEdge(symmetricEdges[edge])];
+        weights[0] = weights[1] = 3.0f / 8.0f;
+        weights[2] = weights[3] = 1.0f / 8.0f;
+    }
 
-            // get weight using loop equation
-            F32 x = (3.0f / 8.0f) + (1.0f / 4.0f) * cos((2.0f * PI) / degree);
-            F32 weight = (1.0f / degree) * ((5.0f / 8.0f) - (x * x));
+    // Moves the vertices to where subdividing a mesh with the connectivity of
+    // the control mesh and the given control positions puts them. Returns
+    // false if the mesh changed since createStencilTables().
+    bool evaluateStencilTables(const V3* positions)
+    {
+        if (stencilTables.empty() || stencilTables.back().getRowsLength() != vertices.size()) return false;
 
-            vertex->position = sumNeighbours(*vertex) * weight + vertex->position * (1.0f - weight * degree);
+        arena.reset();
+        const V3* levelPositions = positions;
+        for (const StencilTable& table : stencilTables)
+        {
+            V3* refinedPositions = arena.allocate<V3>(table.getRowsLength());
+            table.apply(levelPositions, refinedPositions);
+            levelPositions = refinedPositions;
         }
+
+        parallelFor(vertices.size(), [&](U32 begin, U32 end) {
+            for (U32 vertexIndex = begin; vertexIndex < end; vertexIndex += 1)
+            {
+                vertices[vertexIndex].position = levelPositions[vertexIndex];
+            }
+        });
+        computeNormals(normalWeighting);
+        return true;
     }
 
     void draw()
     {
+        if (vertexArray == 0) return;  // not uploaded yet
+
+        glBindVertexArray(vertexArray);
+        if (isLoadedIndexed)
+        {
+            glDrawElements(GL_TRIANGLES, orderedVerticesLength, indexType, 0);
+        }
+        else
+        {
+            glDrawArrays(GL_TRIANGLES, 0, orderedVerticesLength);
+        }
+        glBindVertexArray(0);
+    }
+
+    // instancesLength copies at once, placed by the instanced shaders' per-instance model matrices
+    void drawInstanced(U32 instancesLength)
+    {
+        if (vertexArray == 0) return;  // not uploaded yet
+
+        glBindVertexArray(instancedVertexArray);
+        if (isLoadedIndexed)
+        {
+            glDrawElementsInstanced(GL_TRIANGLES, orderedVerticesLength, indexType, 0, instancesLength);
+        }
+        else
+        {
+            glDrawArraysInstanced(GL_TRIANGLES, 0, orderedVerticesLength, instancesLength);
+        }
+        glBindVertexArray(0);
+    }
+
+    // The bounding sphere and normal cone of every meshlet. The sphere is
+    // grown by a quantization step, since that is how far the uploaded
+    // positions may be from these.
+    void computeMeshletBounds()
+    {
+        F32 quantizationError = length(boundsSize) / 65535;
+        parallelFor(meshlets.size(), [&](U32 begin, U32 end) {
+            for (U32 meshletIndex = begin; meshletIndex < end; meshletIndex += 1)
+            {
+                Meshlet& meshlet = meshlets[meshletIndex];
+                U32      firstCorner = meshlet.firstFace * 3;
+                U32      endCorner = firstCorner + meshlet.facesLength * 3;
+
+                V3 minimum = vertices[indices[firstCorner]].position;
+                V3 maximum = minimum;
+                V3 normalSum;
+                for (U32 corner = firstCorner; corner < endCorner; corner += 1)
+                {
+                    V3 position = vertices[indices[corner]].position;
+                    minimum = V3(std::min(minimum.x, position.x), std::min(minimum.y, position.y), std::min(minimum.z, position.z));
+                    maximum = V3(std::max(maximum.x, position.x), std::max(maximum.y, position.y), std::max(maximum.z, position.z));
+                    if (corner % 3 == 0) normalSum = normalSum + faceNormals[corner / 3];
+                }
+                meshlet.center = (minimum + maximum) * 0.5f;
+
+                F32 radius = 0;
+                for (U32 corner = firstCorner; corner < endCorner; corner += 1)
+                {
+                    radius = std::max(radius, length(vertices[indices[corner]].position - meshlet.center));
+                }
+                meshlet.radius = radius + quantizationError;
+
+                // faces further than about 84 degrees from the axis make the cone useless
+                F32 normalSumLength = length(normalSum);
+                F32 minimumDot = 0;
+                if (0 < normalSumLength)
+                {
+                    meshlet.coneAxis = normalSum * (1 / normalSumLength);
+                    minimumDot = 1;
+                    for (U32 faceIndex = meshlet.firstFace; faceIndex < meshlet.firstFace + meshlet.facesLength; faceIndex += 1)
+                    {
+                        minimumDot = std::min(minimumDot, dot(meshlet.coneAxis, faceNormals[faceIndex]));
+                    }
+                }
+                meshlet.coneCutoff = minimumDot <= 0.1f ? 1 : sqrtf(1 - minimumDot * minimumDot);
+            }
+        });
+    }
+
+    // Draws only the meshlets that may be seen with clipFromObject, the
+    // projection * view * model matrix the shaders use, with one multi-draw
+    // over the visible ranges. Neighbouring visible meshlets become one range.
+    void drawMeshlets(M4 clipFromObject)
+    {
+        if (vertexArray == 0) return;  // not uploaded yet
+
+        Frustum frustum = getFrustum(clipFromObject);
+        drawFirsts.clear();
+        drawCounts.clear();
+        drawOffsets.clear();
+        visibleMeshletsLength = 0;
+        visibleFacesLength = 0;
+        U32 rangeEnd = NO_INDEX;
+        for (const Meshlet& meshlet : meshlets)
+        {
+            if (isMeshletCulled(meshlet, frustum)) continue;
+            visibleMeshletsLength += 1;
+            visibleFacesLength += meshlet.facesLength;
+            if (meshlet.firstFace == rangeEnd)
+            {
+                drawCounts.back() += meshlet.facesLength * 3;
+            }
+            else
+            {
+                drawFirsts.push_back(meshlet.firstFace * 3);
+                drawCounts.push_back(meshlet.facesLength * 3);
+            }
+            rangeEnd = meshlet.firstFace + meshlet.facesLength;
+        }
+        if (drawCounts.empty()) return;
+
         glBindVertexArray(vertexArray);
-        glDrawArrays(GL_TRIANGLES, 0, orderedVerticesLength);
+        if (isLoadedIndexed)
+        {
+            U32 indexSize = indexType == GL_UNSIGNED_SHORT ? sizeof(U16) : sizeof(U32);
+            for (GLint first : drawFirsts)
+            {
+                drawOffsets.push_back((const void*)((U64)first * indexSize));
+            }
+            glMultiDrawElements(GL_TRIANGLES, drawCounts.data(), indexType, drawOffsets.data(), drawCounts.size());
+        }
+        else
+        {
+            glMultiDrawArrays(GL_TRIANGLES, drawFirsts.data(), drawCounts.data(), drawFirsts.size());
+        }
         glBindVertexArray(0);
     }
 };
@@ -0,0 +1,123 @@
+#pragma once
+
+#include "arena.hpp"
+#include "cache.hpp"
+#include "frustum.hpp"
+#include "math.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+#include <vector>
+
+// Meshlets: runs of neighbouring faces, small enough that a bounding sphere
+// and a cone around their normals are tight, so a whole run can be skipped
+// when it is outside the frustum or faces away from the camera. The limits
+// are the usual mesh shader ones; here a meshlet is just a range of faces.
+const U32 MESHLET_MAX_VERTICES = 64;
+const U32 MESHLET_MAX_FACES = 124;
+
+struct Meshlet
+{
+    U32 firstFace = 0;  // the faces firstFace up to firstFace + facesLength
+    U32 facesLength = 0;
+    V3  center;          // bounding sphere
+    F32 radius = 0;
+    V3  coneAxis;        // every face normal is within the cone around it
+    F32 coneCutoff = 1;  // sine of the cone's half angle, 1 if too wide to ever face away
+};
+
+// Grows meshlets across the symmetric edges, taking the neighbouring face
+// that adds the fewest vertices, and earlier in faceOrder on a tie, until
+// either limit is reached. New meshlets start at the first face faceOrder has
+// left, and each meshlet keeps its faces in faceOrder's order, so the vertex
+// cache order is only cut up, not lost. Rewrites faceOrder with every
+// meshlet's faces together and fills meshlets with their ranges.
+void orderFacesIntoMeshlets(Arena& arena, const U32* indices, const U32* symmetricEdges, U32 facesLength, U32 verticesLength, U32* faceOrder, std::vector<Meshlet>& meshlets)
+{
+    U32* faceRanks = arena.allocate<U32>(facesLength);
+    U32* newFaceOrder = arena.allocate<U32>(facesLength);
+    U8*  isTaken = arena.allocate<U8>(facesLength);
+    U32* vertexMeshlets = arena.allocate<U32>(verticesLength);  // the last meshlet to use each vertex
+    U32* candidates = arena.allocate<U32>(3 * MESHLET_MAX_FACES + 1);
+    for (U32 rank = 0; rank < facesLength; rank += 1)
+    {
+        faceRanks[faceOrder[rank]] = rank;
+    }
+    std::fill(isTaken, isTaken + facesLength, 0);
+    std::fill(vertexMeshlets, vertexMeshlets + verticesLength, NO_INDEX);
+
+    meshlets.clear();
+    U32 emitted = 0;
+    for (U32 seedRank = 0; seedRank < facesLength; seedRank += 1)
+    {
+        if (isTaken[faceOrder[seedRank]]) continue;
+
+        U32     meshletIndex = meshlets.size();
+        Meshlet meshlet;
+        meshlet.firstFace = emitted;
+        U32 meshletVertices = 0;
+        U32 candidatesLength = 0;
+        candidates[candidatesLength++] = faceOrder[seedRank];
+
+        while (meshlet.facesLength < MESHLET_MAX_FACES)
+        {
+            // taken faces leave the candidates as they are passed over
+            U32 bestFace = NO_INDEX, bestNewVertices = 4;
+            U32 keptLength = 0;
+            for (U32 slot = 0; slot < candidatesLength; slot += 1)
+            {
+                U32 face = candidates[slot];
+                if (isTaken[face]) continue;
+                candidates[keptLength++] = face;
+
+                U32 newVertices = 0;
+                for (U32 corner = face * 3; corner < face * 3 + 3; corner += 1)
+                {
+                    newVertices += vertexMeshlets[indices[corner]] != meshletIndex;
+                }
+                if (MESHLET_MAX_VERTICES < meshletVertices + newVertices) continue;
+                if (newVertices < bestNewVertices || (newVertices == bestNewVertices && faceRanks[face] < faceRanks[bestFace]))
+                {
+                    bestFace = face;
+                    bestNewVertices = newVertices;
+                }
+            }
+            candidatesLength = keptLength;
+            if (bestFace == NO_INDEX) break;
+
+            isTaken[bestFace] = 1;
+            newFaceOrder[emitted++] = bestFace;
+            meshlet.facesLength += 1;
+            for (U32 corner = bestFace * 3; corner < bestFace * 3 + 3; corner += 1)
+            {
+                U32 vertex = indices[corner];
+                if (vertexMeshlets[vertex] != meshletIndex)
+                {
+                    vertexMeshlets[vertex] = meshletIndex;
+                    meshletVertices += 1;
+                }
+                U32 symmetricEdge = symmetricEdges[corner];
+                if (symmetricEdge != NO_INDEX && !isTaken[symmetricEdge / 3]) candidates[candidatesLength++] = symmetricEdge / 3;
+            }
+        }
+
+        std::sort(newFaceOrder + meshlet.firstFace, newFaceOrder + emitted, [&](U32 a, U32 b) { return faceRanks[a] < faceRanks[b]; });
+        meshlets.push_back(meshlet);
+    }
+    std::copy(newFaceOrder, newFaceOrder + facesLength, faceOrder);
+}
+
+// True if none of the meshlet's faces can show: its sphere is outside the
+// frustum, or every point of the sphere sees every normal of the cone from
+// behind (Shirman and Abi-Ezzi's normal cone test, in the form meshoptimizer
+// uses for a sphere rather than an apex). The back face test assumes back
+// faces are not meant to be seen, which only holds for closed meshes.
+bool isMeshletCulled(const Meshlet& meshlet, const Frustum& frustum)
+{
+    if (isSphereOutside(frustum, meshlet.center, meshlet.radius)) return true;
+
+    V3  center = meshlet.center;
+    V3  fromEye = center - frustum.eye;
+    F32 distance = length(fromEye);
+    return meshlet.coneCutoff * distance + meshlet.radius <= dot(fromEye, meshlet.coneAxis);
+}
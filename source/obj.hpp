@@ -0,0 +1,316 @@
+#pragma once
+
+#include "math.hpp"
+#include "parallel.hpp"
+#include "types.hpp"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+
+// Wavefront OBJ parsing straight out of a mapped file. The scanners below
+// replace std::istringstream/std::stof: they read in place, allocate only for
+// numbers too long for a stack buffer, and return the position just past
+// what they consumed.
+
+struct ObjData
+{
+    std::vector<V3>  positions;
+    std::vector<U32> indices;  // triangle list, 0-based
+    F32              max = 0;  // largest positive coordinate, used to scale into the unit cube
+
+    // slots in indices resolved from negative (relative) OBJ indices, which are
+    // only correct once the vertices of every earlier chunk are counted in
+    std::vector<U32> relativeIndices;
+
+    // empties the arrays but keeps their memory for the next file
+    void clear()
+    {
+        positions.clear();
+        indices.clear();
+        relativeIndices.clear();
+        max = 0;
+    }
+};
+
+// smallest slice of a file worth handing to its own thread
+const U64 OBJ_CHUNK_SIZE = 1 << 20;
+
+const F64 POWERS_OF_TEN[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+bool isDigit(char c)
+{
+    return (U8)(c - '0') < 10;
+}
+
+bool isBlank(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+const char* skipBlanks(const char* p, const char* end)
+{
+    while (p < end && isBlank(*p)) p++;
+    return p;
+}
+
+const char* skipLine(const char* p, const char* end)
+{
+    const char* newline = (const char*)memchr(p, '\n', end - p);
+    return newline == nullptr ? end : newline + 1;
+}
+
+// strtof of the number in [begin, end), on a terminated copy
+F32 parseF32Exactly(const char* begin, const char* end)
+{
+    char buffer[64];
+    U64  length = end - begin;
+    if (sizeof(buffer) <= length) return strtof(std::string(begin, end).c_str(), nullptr);
+
+    memcpy(buffer, begin, length);
+    buffer[length] = '\0';
+    return strtof(buffer, nullptr);
+}
+
+// [sign] digits [. digits] [e [sign] digits]
+const char* scanF32(const char* p, const char* end, F32& value)
+{
+    const char* start = p;
+    bool        negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    // accumulate up to 19 significant digits exactly, the rest only shift the exponent
+    U64 mantissa = 0;
+    I32 digits = 0;
+    I32 exponent = 0;
+    while (p < end && isDigit(*p))
+    {
+        if (digits < 19)
+        {
+            mantissa = mantissa * 10 + (*p - '0');
+            if (mantissa != 0) digits++;
+        }
+        else
+        {
+            exponent++;
+        }
+        p++;
+    }
+    if (p < end && *p == '.')
+    {
+        p++;
+        while (p < end && isDigit(*p))
+        {
+            if (digits < 19)
+            {
+                mantissa = mantissa * 10 + (*p - '0');
+                if (mantissa != 0) digits++;
+                exponent--;
+            }
+            p++;
+        }
+    }
+    if (p < end && (*p == 'e' || *p == 'E'))
+    {
+        p++;
+        bool negativeExponent = false;
+        if (p < end && (*p == '-' || *p == '+'))
+        {
+            negativeExponent = *p == '-';
+            p++;
+        }
+        I32 n = 0;
+        while (p < end && isDigit(*p))
+        {
+            if (n < 10000) n = n * 10 + (*p - '0');
+            p++;
+        }
+        exponent += negativeExponent ? -n : n;
+    }
+
+    // mantissa <= 2^53 and |exponent| <= 22 are exact doubles, so this is a
+    // single correctly rounded operation. Narrowing to F32 then rounds once
+    // more, which only goes wrong when the double landed exactly halfway
+    // between two floats, its low 29 mantissa bits 1000...0.
+    if (mantissa <= (1ull << 53) && -22 <= exponent && exponent <= 22)
+    {
+        F64 result = (F64)mantissa;
+        if (exponent < 0) result /= POWERS_OF_TEN[-exponent];
+        if (exponent > 0) result *= POWERS_OF_TEN[exponent];
+
+        U64 bits;
+        memcpy(&bits, &result, sizeof(bits));
+        if ((bits & 0x1FFFFFFF) != 0x10000000)
+        {
+            value = (F32)(negative ? -result : result);
+            return p;
+        }
+    }
+
+    // anything else, such as more than 15 significant digits, goes through strtof
+    value = parseF32Exactly(start, p);
+    return p;
+}
+
+const char* scanI32(const char* p, const char* end, I32& value)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+'))
+    {
+        negative = *p == '-';
+        p++;
+    }
+
+    // saturates, so an index too large for I32 stays out of range
+    I64 n = 0;
+    while (p < end && isDigit(*p))
+    {
+        n = std::min<I64>(n * 10 + (*p - '0'), 0x80000000);
+        p++;
+    }
+
+    value = negative ? (I32)-n : (I32)std::min<I64>(n, 0x7FFFFFFF);
+    return p;
+}
+
+// Parses the lines in [p, end) and appends to data. Face corners are read as
+// "v", "v/vt", "v//vn" or "v/vt/vn"; only the position index is kept and
+// polygons are fanned into triangles.
+void parseObj(const char* p, const char* end, ObjData& data)
+{
+    while (p < end)
+    {
+        p = skipBlanks(p, end);
+        if (end - p < 2 || !isBlank(p[1]))
+        {
+            p = skipLine(p, end);
+            continue;
+        }
+
+        if (p[0] == 'v')
+        {
+            V3 position;
+            p = scanF32(skipBlanks(p + 2, end), end, position.x);
+            p = scanF32(skipBlanks(p, end), end, position.y);
+            p = scanF32(skipBlanks(p, end), end, position.z);
+            data.positions.push_back(position);
+
+            if (data.max < position.x) data.max = position.x;
+            if (data.max < position.y) data.max = position.y;
+            if (data.max < position.z) data.max = position.z;
+        }
+        else if (p[0] == 'f')
+        {
+            p += 2;
+            U32  first = 0, previous = 0;
+            bool isFirstRelative = false, isPreviousRelative = false;
+            for (U32 corner = 0;; corner++)
+            {
+                p = skipBlanks(p, end);
+                if (p == end || !(isDigit(*p) || *p == '-' || *p == '+')) break;
+
+                I32 index;
+                p = scanI32(p, end, index);
+                while (p < end && !isBlank(*p) && *p != '\n') p++;  // texture and normal indices
+
+                // 1-based, negative values count back from the latest vertex
+                bool isRelative = index < 0;
+                U32  vertexIndex = isRelative ? data.positions.size() + index : index - 1;
+
+                if (corner == 0)
+                {
+                    first = vertexIndex;
+                    isFirstRelative = isRelative;
+                }
+                if (2 <= corner)
+                {
+                    U32 slot = data.indices.size();
+                    if (isFirstRelative) data.relativeIndices.push_back(slot + 0);
+                    if (isPreviousRelative) data.relativeIndices.push_back(slot + 1);
+                    if (isRelative) data.relativeIndices.push_back(slot + 2);
+
+                    data.indices.push_back(first);
+                    data.indices.push_back(previous);
+                    data.indices.push_back(vertexIndex);
+                }
+                previous = vertexIndex;
+                isPreviousRelative = isRelative;
+            }
+        }
+
+        p = skipLine(p, end);
+    }
+}
+
+// Splits [begin, end) into one chunk per thread at line boundaries, parses the
+// chunks concurrently and concatenates them in file order. Absolute indices
+// need no fixup across chunks; relative ones are offset by the vertex count of
+// the chunks before them.
+void parseObjParallel(const char* begin, const char* end, ObjData& data, U32 threadCount)
+{
+    std::vector<const char*> bounds(threadCount + 1);
+    bounds[0] = begin;
+    bounds[threadCount] = end;
+    for (U32 chunkIndex = 1; chunkIndex < threadCount; chunkIndex += 1)
+    {
+        const char* split = begin + (end - begin) * chunkIndex / threadCount;
+        bounds[chunkIndex] = std::max(bounds[chunkIndex - 1], skipLine(std::max(split, begin + 1) - 1, end));
+    }
+
+    std::vector<ObjData> chunks(threadCount);
+    parallelTasks(threadCount, [&](U32 chunkIndex) {
+        parseObj(bounds[chunkIndex], bounds[chunkIndex + 1], chunks[chunkIndex]);
+    });
+
+    std::vector<U32> positionOffsets(threadCount + 1, 0);
+    std::vector<U32> indexOffsets(threadCount + 1, 0);
+    for (U32 chunkIndex = 0; chunkIndex < threadCount; chunkIndex += 1)
+    {
+        positionOffsets[chunkIndex + 1] = positionOffsets[chunkIndex] + chunks[chunkIndex].positions.size();
+        indexOffsets[chunkIndex + 1] = indexOffsets[chunkIndex] + chunks[chunkIndex].indices.size();
+        data.max = std::max(data.max, chunks[chunkIndex].max);
+    }
+
+    data.positions.resize(positionOffsets[threadCount]);
+    data.indices.resize(indexOffsets[threadCount]);
+
+    parallelTasks(threadCount, [&](U32 chunkIndex) {
+        ObjData& chunk = chunks[chunkIndex];
+        std::copy(chunk.positions.begin(), chunk.positions.end(), data.positions.begin() + positionOffsets[chunkIndex]);
+
+        U32* indices = &data.indices[0] + indexOffsets[chunkIndex];
+        std::copy(chunk.indices.begin(), chunk.indices.end(), indices);
+        for (U32 slot : chunk.relativeIndices)
+        {
+            indices[slot] += positionOffsets[chunkIndex];
+        }
+    });
+}
+
+// Drops the triangles with a corner that names no vertex: an index of 0, one
+// past the last vertex, or a relative one reaching back before the first.
+// Parsing only knows every vertex once all chunks are in, so this runs after
+// it. Returns how many triangles were dropped.
+U32 dropInvalidFaces(ObjData& data)
+{
+    U32 positionsLength = data.positions.size();
+    U32 indicesLength = data.indices.size();
+    U32 keptLength = 0;
+    for (U32 corner = 0; corner < indicesLength; corner += 3)
+    {
+        const U32* face = &data.indices[corner];
+        if (positionsLength <= face[0] || positionsLength <= face[1] || positionsLength <= face[2]) continue;
+        if (keptLength != corner) std::copy(face, face + 3, &data.indices[keptLength]);
+        keptLength += 3;
+    }
+    data.indices.resize(keptLength);
+    return (indicesLength - keptLength) / 3;
+}
@@ -0,0 +1,244 @@
+#pragma once
+
+#include "types.hpp"
+
+#include <algorithm>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Most tasks a batch is split into, so per-task scratch fits on the stack.
+const U32 MAX_TASKS = 32;
+
+// Number of threads work is split across, including the calling thread.
+U32 getThreadCount()
+{
+    U32 count = std::thread::hardware_concurrency();
+    return count == 0 ? 1 : std::min(count, MAX_TASKS);
+}
+
+// set on a thread while it runs a task, so a nested batch runs inline
+thread_local bool isRunningTask = false;
+
+// Worker threads started on first use and kept until exit. A batch is one
+// function and a task count, handed over through the fields below without
+// allocating; workers and the calling thread claim task indices until none
+// are left. One batch runs at a time, and a caller that finds the pool busy
+// (the loader thread and the render thread both build meshes) runs its
+// tasks itself instead of waiting.
+struct WorkerPool
+{
+    std::vector<std::thread> workers;
+    std::mutex               batchMutex;  // held by the thread whose batch is running
+    std::mutex               mutex;       // guards the fields below
+    std::condition_variable  wake;
+    std::condition_variable  finished;
+
+    void (*runTask)(void* function, U32 taskIndex) = nullptr;
+    void* function = nullptr;
+    U32   tasksLength = 0;
+    U32   nextTask = 0;
+    U32   unfinishedTasks = 0;
+    bool  isRunning = true;
+
+    WorkerPool(U32 workersLength)
+    {
+        workers.reserve(workersLength);
+        for (U32 workerIndex = 0; workerIndex < workersLength; workerIndex += 1)
+        {
+            workers.emplace_back(&WorkerPool::work, this);
+        }
+    }
+
+    ~WorkerPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            isRunning = false;
+        }
+        wake.notify_all();
+        for (std::thread& worker : workers)
+        {
+            worker.join();
+        }
+    }
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true)
+        {
+            wake.wait(lock, [&] { return nextTask < tasksLength || !isRunning; });
+            if (!isRunning) return;
+            runTasks(lock);
+        }
+    }
+
+    // runs tasks of the current batch until every one has been claimed
+    void runTasks(std::unique_lock<std::mutex>& lock)
+    {
+        while (nextTask < tasksLength)
+        {
+            U32 taskIndex = nextTask++;
+            lock.unlock();
+            isRunningTask = true;
+            runTask(function, taskIndex);
+            isRunningTask = false;
+            lock.lock();
+            unfinishedTasks -= 1;
+            if (unfinishedTasks == 0) finished.notify_all();
+        }
+    }
+
+    // false if another batch is running, in which case nothing was run
+    template <typename F>
+    bool run(U32 taskCount, F& taskFunction)
+    {
+        std::unique_lock<std::mutex> batchLock(batchMutex, std::try_to_lock);
+        if (!batchLock.owns_lock()) return false;
+
+        std::unique_lock<std::mutex> lock(mutex);
+        runTask = [](void* function, U32 taskIndex) { (*(F*)function)(taskIndex); };
+        function = &taskFunction;
+        tasksLength = taskCount;
+        nextTask = 0;
+        unfinishedTasks = taskCount;
+        wake.notify_all();
+
+        runTasks(lock);
+        finished.wait(lock, [&] { return unfinishedTasks == 0; });
+        tasksLength = 0;
+        nextTask = 0;
+        return true;
+    }
+};
+
+WorkerPool& getWorkerPool()
+{
+    static WorkerPool pool(getThreadCount() - 1);
+    return pool;
+}
+
+// Runs function(taskIndex) for every task in [0, taskCount), spread over the
+// worker pool and the calling thread, and returns once every task has
+// finished. taskCount is at most getThreadCount().
+template <typename F>
+void parallelTasks(U32 taskCount, F function)
+{
+    if (1 < taskCount && !isRunningTask && getWorkerPool().run(taskCount, function)) return;
+
+    for (U32 taskIndex = 0; taskIndex < taskCount; taskIndex += 1)
+    {
+        function(taskIndex);
+    }
+}
+
+// Splits [0, count) into one contiguous range per thread and runs
+// function(begin, end) on each. Ranges smaller than grain run inline.
+template <typename F>
+void parallelFor(U32 count, F function, U32 grain = 4096)
+{
+    U32 taskCount = std::min(getThreadCount(), (count + grain - 1) / std::max(grain, 1u));
+    if (taskCount <= 1)
+    {
+        function(0u, count);
+        return;
+    }
+
+    parallelTasks(taskCount, [&](U32 taskIndex) {
+        U32 begin = (U64)count * taskIndex / taskCount;
+        U32 end = (U64)count * (taskIndex + 1) / taskCount;
+        function(begin, end);
+    });
+}
+
+// Numbers the indices in [0, count) for which isSelected(index) holds in
+// increasing order, calling function(index, number) for each of them, and
+// returns how many there are. Each thread counts its range first, so the
+// numbers come out exactly as a serial loop would hand them out.
+template <typename P, typename F>
+U32 parallelCompact(U32 count, P isSelected, F function, U32 grain = 4096)
+{
+    U32 taskCount = std::max(1u, std::min(getThreadCount(), (count + grain - 1) / std::max(grain, 1u)));
+
+    U32 offsets[MAX_TASKS + 1] = {};
+    parallelTasks(taskCount, [&](U32 taskIndex) {
+        U32 end = (U64)count * (taskIndex + 1) / taskCount;
+        for (U32 index = (U64)count * taskIndex / taskCount; index < end; index += 1)
+        {
+            if (isSelected(index)) offsets[taskIndex + 1] += 1;
+        }
+    });
+    for (U32 taskIndex = 0; taskIndex < taskCount; taskIndex += 1)
+    {
+        offsets[taskIndex + 1] += offsets[taskIndex];
+    }
+
+    parallelTasks(taskCount, [&](U32 taskIndex) {
+        U32 number = offsets[taskIndex];
+        U32 end = (U64)count * (taskIndex + 1) / taskCount;
+        for (U32 index = (U64)count * taskIndex / taskCount; index < end; index += 1)
+        {
+            if (isSelected(index)) function(index, number++);
+        }
+    });
+    return offsets[taskCount];
+}
+
+// Stable LSD radix sort of items[0, count) on the low keyBits bits of
+// getKey(item), eight bits per pass. Each pass histograms and scatters one
+// contiguous block per thread; scratch must hold count items.
+template <typename T, typename K>
+void parallelRadixSort(T* items, T* scratch, U32 count, U32 keyBits, K getKey)
+{
+    const U32 RADIX = 256;
+
+    T*  source = items;
+    T*  destination = scratch;
+    U32 taskCount = std::max(1u, std::min(getThreadCount(), count / 16384));
+
+    U32 offsets[MAX_TASKS * RADIX];
+    for (U32 shift = 0; shift < keyBits; shift += 8)
+    {
+        parallelTasks(taskCount, [&](U32 taskIndex) {
+            U32* histogram = &offsets[taskIndex * RADIX];
+            std::fill(histogram, histogram + RADIX, 0);
+
+            U32 end = (U64)count * (taskIndex + 1) / taskCount;
+            for (U32 index = (U64)count * taskIndex / taskCount; index < end; index += 1)
+            {
+                histogram[(getKey(source[index]) >> shift) & (RADIX - 1)] += 1;
+            }
+        });
+
+        // digits in order, and within a digit the blocks in order, keeps it stable
+        U32 offset = 0;
+        for (U32 digit = 0; digit < RADIX; digit += 1)
+        {
+            for (U32 taskIndex = 0; taskIndex < taskCount; taskIndex += 1)
+            {
+                U32 digitCount = offsets[taskIndex * RADIX + digit];
+                offsets[taskIndex * RADIX + digit] = offset;
+                offset += digitCount;
+            }
+        }
+
+        parallelTasks(taskCount, [&](U32 taskIndex) {
+            U32* next = &offsets[taskIndex * RADIX];
+
+            U32 end = (U64)count * (taskIndex + 1) / taskCount;
+            for (U32 index = (U64)count * taskIndex / taskCount; index < end; index += 1)
+            {
+                destination[next[(getKey(source[index]) >> shift) & (RADIX - 1)]++] = source[index];
+            }
+        });
+
+        std::swap(source, destination);
+    }
+
+    if (source != items)
+    {
+        parallelFor(count, [&](U32 begin, U32 end) { std::copy(source + begin, source + end, items + begin); });
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include "math.hpp"
+#include "types.hpp"
+
+#include <math.h>
+
+// Garland and Heckbert's quadric error: the weighted sum of squared distances
+// to a set of planes, as p^T A p + 2 b^T p + c with A symmetric. Doubles,
+// since the sums of many nearly parallel planes are close to singular.
+struct Quadric
+{
+    F64 xx = 0, xy = 0, xz = 0, yy = 0, yz = 0, zz = 0;  // A
+    F64 x = 0, y = 0, z = 0;                             // b
+    F64 c = 0;
+
+    void add(const Quadric& other)
+    {
+        xx += other.xx, xy += other.xy, xz += other.xz, yy += other.yy, yz += other.yz, zz += other.zz;
+        x += other.x, y += other.y, z += other.z;
+        c += other.c;
+    }
+
+    F64 getError(V3 point) const
+    {
+        F64 px = point.x, py = point.y, pz = point.z;
+        F64 error = xx * px * px + yy * py * py + zz * pz * pz + 2 * (xy * px * py + xz * px * pz + yz * py * pz) + 2 * (x * px + y * py + z * pz) + c;
+        return error < 0 ? 0 : error;  // rounding
+    }
+
+    // the point of least error, false if A is too close to singular for one
+    bool getMinimum(V3& point) const
+    {
+        F64 cofactorX = yy * zz - yz * yz;
+        F64 cofactorY = xz * yz - xy * zz;
+        F64 cofactorZ = xy * yz - xz * yy;
+        F64 determinant = xx * cofactorX + xy * cofactorY + xz * cofactorZ;
+
+        // relative to the size of A, so it does not depend on the mesh scale
+        F64 trace = xx + yy + zz;
+        if (fabs(determinant) <= 1e-6 * trace * trace * trace) return false;
+
+        // A^-1 (-b) by the adjugate
+        F64 inverse = -1 / determinant;
+        point.x = (cofactorX * x + cofactorY * y + cofactorZ * z) * inverse;
+        point.y = (cofactorY * x + (xx * zz - xz * xz) * y + (xy * xz - xx * yz) * z) * inverse;
+        point.z = (cofactorZ * x + (xy * xz - xx * yz) * y + (xx * yy - xy * xy) * z) * inverse;
+        return true;
+    }
+};
+
+// weight times the squared distance to the plane through point with unit normal
+Quadric getPlaneQuadric(V3 normal, V3 point, F64 weight)
+{
+    F64 a = normal.x, b = normal.y, c = normal.z;
+    F64 d = -(a * point.x + b * point.y + c * point.z);
+
+    Quadric quadric;
+    quadric.xx = weight * a * a, quadric.xy = weight * a * b, quadric.xz = weight * a * c;
+    quadric.yy = weight * b * b, quadric.yz = weight * b * c, quadric.zz = weight * c * c;
+    quadric.x = weight * a * d, quadric.y = weight * b * d, quadric.z = weight * c * d;
+    quadric.c = weight * d * d;
+    return quadric;
+}
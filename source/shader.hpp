@@ -1,65 +1,192 @@
 #pragma once
 
+#include "cache.hpp"
+#include "file.hpp"
 #include "math.hpp"
 #include "types.hpp"
 
 #include <glad/glad.h>
 
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
 #include <fstream>
 #include <iostream>
-#include <sstream>
 #include <string>
+#include <vector>
+
+// FNV-1a of a uniform name. A constexpr UniformName is hashed by the
+// compiler, so setting a uniform through one costs a probe of the table, a
+// compare of the name and the glUniform* call; a plain string works too,
+// hashed on every call.
+constexpr U32 hashUniformName(const char *name)
+{
+    U32 hash = 2166136261u;
+    for (; *name != '\0'; name += 1)
+    {
+        hash = (hash ^ (U8)*name) * 16777619u;
+    }
+    return hash;
+}
+
+struct UniformName
+{
+    U32         hash;
+    const char *name;
+
+    constexpr UniformName(const char *name) : hash(hashUniformName(name)), name(name) {}
+};
+
+// The uniforms every program shares, written once a frame into one std140
+// uniform buffer instead of into each program. The shaders declare the same
+// fields as the block Frame, in this order; a vec3 takes a whole vec4 slot.
+const U32 FRAME_UNIFORM_BINDING = 0;
+
+struct FrameUniforms
+{
+    M4 view;
+    M4 projection;
+    V4 light;
+};
+static_assert(sizeof(FrameUniforms) == 144, "FrameUniforms must match the std140 layout of Frame");
+
+struct FrameUniformBuffer
+{
+    U32 buffer = 0;
+
+    void update(const FrameUniforms &uniforms)
+    {
+        if (buffer == 0)
+        {
+            glGenBuffers(1, &buffer);
+            glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+            glBufferData(GL_UNIFORM_BUFFER, sizeof(FrameUniforms), nullptr, GL_DYNAMIC_DRAW);
+            glBindBufferBase(GL_UNIFORM_BUFFER, FRAME_UNIFORM_BINDING, buffer);
+        }
+        glBindBuffer(GL_UNIFORM_BUFFER, buffer);
+        glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(FrameUniforms), &uniforms);
+    }
+};
+
+// glGetProgramBinary and glProgramBinary are OpenGL 4.1, or the extension
+// ARB_get_program_binary, past the 3.3 core glad was generated for, so they
+// are loaded by hand once there is a context. Without them, or when the
+// driver offers no binary format, every program is compiled from source.
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+typedef void(APIENTRYP GetProgramBinaryFunction)(GLuint program, GLsizei bufferSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void(APIENTRYP ProgramBinaryFunction)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void(APIENTRYP ProgramParameteriFunction)(GLuint program, GLenum name, GLint value);
+
+struct ProgramBinaryCache
+{
+    GetProgramBinaryFunction  getProgramBinary = nullptr;
+    ProgramBinaryFunction     programBinary = nullptr;
+    ProgramParameteriFunction programParameteri = nullptr;
+    U64                       driverHash = 0;  // hashBytes() of the GL vendor, renderer and version
+    bool                      isEnabled = false;
+};
+ProgramBinaryCache programBinaryCache;
+
+// call after gladLoadGLLoader, with the same loader
+void loadProgramBinaryCache(GLADloadproc load)
+{
+    GLint majorVersion = 0, minorVersion = 0, extensionsLength = 0;
+    glGetIntegerv(GL_MAJOR_VERSION, &majorVersion);
+    glGetIntegerv(GL_MINOR_VERSION, &minorVersion);
+    glGetIntegerv(GL_NUM_EXTENSIONS, &extensionsLength);
+    bool isSupported = 4 < majorVersion || (majorVersion == 4 && 1 <= minorVersion);
+    for (GLint extension = 0; extension < extensionsLength && !isSupported; extension += 1)
+    {
+        isSupported = strcmp((const char *)glGetStringi(GL_EXTENSIONS, extension), "GL_ARB_get_program_binary") == 0;
+    }
+    if (!isSupported) return;
+
+    programBinaryCache.getProgramBinary = (GetProgramBinaryFunction)load("glGetProgramBinary");
+    programBinaryCache.programBinary = (ProgramBinaryFunction)load("glProgramBinary");
+    programBinaryCache.programParameteri = (ProgramParameteriFunction)load("glProgramParameteri");
+
+    GLint formatsLength = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formatsLength);
+    programBinaryCache.isEnabled = programBinaryCache.getProgramBinary != nullptr && programBinaryCache.programBinary != nullptr &&
+                                   programBinaryCache.programParameteri != nullptr && 0 < formatsLength;
+
+    std::string driver;
+    for (GLenum name : {GL_VENDOR, GL_RENDERER, GL_VERSION})
+    {
+        const GLubyte *value = glGetString(name);
+        if (value != nullptr) driver += (const char *)value;
+        driver += '\n';
+    }
+    programBinaryCache.driverHash = hashBytes(driver.data(), driver.size());
+}
 
 struct Shader
 {
     U32 ID;
-    // constructor generates the shader on the fly
+
+    // the location of every active uniform by the hash of its name, open
+    // addressed in a power of two table, filled once when the program links;
+    // names whose hashes collide take separate slots and the name decides
+    struct UniformSlot
+    {
+        U32         hash = 0;
+        I32         location = -1;  // -1 for an empty slot, which glUniform* also ignores
+        std::string name;
+    };
+    std::vector<UniformSlot> uniformSlots;
+    U32                      uniformSlotMask = 0;
+    bool isFromCache = false;  // whether the program came out of its binary cache
+    F64  buildMilliseconds = 0;
+    // constructor generates the shader on the fly, or loads the program the
+    // driver linked from the same sources last time
     // ------------------------------------------------------------------------
     Shader(const char *vertexPath, const char *fragmentPath, const char *geometryPath = nullptr)
     {
+        auto start = std::chrono::steady_clock::now();
         // 1. retrieve the vertex/fragment source code from filePath
-        std::string   vertexCode;
-        std::string   fragmentCode;
-        std::string   geometryCode;
-        std::ifstream vShaderFile;
-        std::ifstream fShaderFile;
-        std::ifstream gShaderFile;
-        // ensure ifstream objects can throw exceptions:
-        vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        gShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-        try
+        std::string vertexCode = readSource(vertexPath);
+        std::string fragmentCode = readSource(fragmentPath);
+        std::string geometryCode;
+        if (geometryPath != nullptr) geometryCode = readSource(geometryPath);
+
+        // the cache is reused until a stage or the driver changes
+        std::string sources = std::string(vertexPath) + '\0' + vertexCode + '\0' + fragmentPath + '\0' + fragmentCode;
+        if (geometryPath != nullptr) sources += '\0' + std::string(geometryPath) + '\0' + geometryCode;
+        U64         sourceHash = hashBytes(sources.data(), sources.size());
+        std::string cachePath = getProgramCachePath(vertexPath, fragmentPath, geometryPath);
+
+        ID = glCreateProgram();
+        isFromCache = readProgramCache(cachePath, sourceHash);
+        if (!isFromCache)
         {
-            // open files
-            vShaderFile.open(vertexPath);
-            fShaderFile.open(fragmentPath);
-            std::stringstream vShaderStream, fShaderStream;
-            // read file's buffer contents into streams
-            vShaderStream << vShaderFile.rdbuf();
-            fShaderStream << fShaderFile.rdbuf();
-            // close file handlers
-            vShaderFile.close();
-            fShaderFile.close();
-            // convert stream into string
-            vertexCode = vShaderStream.str();
-            fragmentCode = fShaderStream.str();
-            // if geometry shader path is present, also load a geometry shader
-            if (geometryPath != nullptr)
-            {
-                gShaderFile.open(geometryPath);
-                std::stringstream gShaderStream;
-                gShaderStream << gShaderFile.rdbuf();
-                gShaderFile.close();
-                geometryCode = gShaderStream.str();
-            }
+            compile(vertexCode.c_str(), fragmentCode.c_str(), geometryPath != nullptr ? geometryCode.c_str() : nullptr);
+            writeProgramCache(cachePath, sourceHash);
         }
-        catch (std::ifstream::failure e)
+        reflectUniforms();
+
+        buildMilliseconds = std::chrono::duration<F64, std::milli>(std::chrono::steady_clock::now() - start).count();
+        std::cout << (isFromCache ? "loaded " : "compiled ") << vertexPath << " program in " << buildMilliseconds << " ms" << std::endl;
+    }
+
+    std::string readSource(const char *path)
+    {
+        MappedFile file = MappedFile(path);
+        if (!file.isOpen())
         {
-            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
+            std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ " << path << std::endl;
+            return std::string();
         }
-        const char *vShaderCode = vertexCode.c_str();
-        const char *fShaderCode = fragmentCode.c_str();
-        // 2. compile shaders
+        return std::string(file.data, file.size);
+    }
+
+    // 2. compile shaders and link them into ID
+    void compile(const char *vShaderCode, const char *fShaderCode, const char *gShaderCode)
+    {
         U32 vertex, fragment;
         // vertex shader
         vertex = glCreateShader(GL_VERTEX_SHADER);
@@ -73,27 +200,92 @@ struct Shader
         checkCompileErrors(fragment, "FRAGMENT");
         // if geometry shader is given, compile geometry shader
         U32 geometry;
-        if (geometryPath != nullptr)
+        if (gShaderCode != nullptr)
         {
-            const char *gShaderCode = geometryCode.c_str();
             geometry = glCreateShader(GL_GEOMETRY_SHADER);
             glShaderSource(geometry, 1, &gShaderCode, NULL);
             glCompileShader(geometry);
             checkCompileErrors(geometry, "GEOMETRY");
         }
         // shader Program
-        ID = glCreateProgram();
         glAttachShader(ID, vertex);
         glAttachShader(ID, fragment);
-        if (geometryPath != nullptr)
+        if (gShaderCode != nullptr)
             glAttachShader(ID, geometry);
+        // ask for a binary that can be read back, before the link that makes it
+        if (programBinaryCache.isEnabled) programBinaryCache.programParameteri(ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
         glLinkProgram(ID);
         checkCompileErrors(ID, "PROGRAM");
         // delete the shaders as they're linked into our program now and no longer necessery
+        glDetachShader(ID, vertex);
+        glDetachShader(ID, fragment);
         glDeleteShader(vertex);
         glDeleteShader(fragment);
-        if (geometryPath != nullptr)
+        if (gShaderCode != nullptr)
+        {
+            glDetachShader(ID, geometry);
             glDeleteShader(geometry);
+        }
+    }
+
+    // The driver may still refuse a binary whose key matches, e.g. after an
+    // update that kept the version string, so only a linked program counts.
+    bool readProgramCache(const std::string &path, U64 sourceHash)
+    {
+        if (!programBinaryCache.isEnabled) return false;
+        MappedFile file = MappedFile(path);
+        if (!file.isOpen() || file.size < sizeof(ProgramCacheHeader)) return false;
+
+        ProgramCacheHeader header;
+        memcpy(&header, file.data, sizeof(ProgramCacheHeader));
+        if (header.magic != PROGRAM_CACHE_MAGIC || header.version != PROGRAM_CACHE_VERSION || header.sourceHash != sourceHash) return false;
+        if (header.driverHash != programBinaryCache.driverHash || file.size != sizeof(ProgramCacheHeader) + header.binaryLength) return false;
+
+        programBinaryCache.programBinary(ID, header.binaryFormat, file.data + sizeof(ProgramCacheHeader), header.binaryLength);
+        GLint success;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (success) return true;
+
+        // start over from a clean program rather than relink a rejected one
+        glDeleteProgram(ID);
+        ID = glCreateProgram();
+        return false;
+    }
+
+    void writeProgramCache(const std::string &path, U64 sourceHash)
+    {
+        GLint success = 0, binaryLength = 0;
+        glGetProgramiv(ID, GL_LINK_STATUS, &success);
+        if (!programBinaryCache.isEnabled || !success) return;
+        glGetProgramiv(ID, GL_PROGRAM_BINARY_LENGTH, &binaryLength);
+        if (binaryLength <= 0) return;
+
+        ProgramCacheHeader header = {};
+        header.magic = PROGRAM_CACHE_MAGIC;
+        header.version = PROGRAM_CACHE_VERSION;
+        header.sourceHash = sourceHash;
+        header.driverHash = programBinaryCache.driverHash;
+
+        std::vector<char> binary(binaryLength);
+        GLsizei           writtenLength = 0;
+        GLenum            binaryFormat = 0;
+        programBinaryCache.getProgramBinary(ID, binaryLength, &writtenLength, &binaryFormat, binary.data());
+        if (writtenLength <= 0) return;
+        header.binaryFormat = binaryFormat;
+        header.binaryLength = writtenLength;
+
+        // write beside the final path and rename, so a reader never maps a half-written cache
+        std::string   temporaryPath = path + ".tmp";
+        std::ofstream file = std::ofstream(temporaryPath, std::ios::binary);
+        file.write((const char *)&header, sizeof(ProgramCacheHeader));
+        file.write(binary.data(), writtenLength);
+        file.close();
+
+        if (!file || rename(temporaryPath.c_str(), path.c_str()) != 0)
+        {
+            std::cout << "program cache not written: " << path << std::endl;
+            remove(temporaryPath.c_str());
+        }
     }
     // activate the shader
     // ------------------------------------------------------------------------
@@ -101,51 +293,98 @@ struct Shader
     {
         glUseProgram(ID);
     }
-    // utility uniform functions
+    // Every active uniform outside a block, looked up once, and the Frame
+    // block bound to the buffer FrameUniformBuffer fills.
+    void reflectUniforms()
+    {
+        GLint uniformsLength = 0, maxNameLength = 0;
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORMS, &uniformsLength);
+        glGetProgramiv(ID, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxNameLength);
+
+        U32 slotsLength = 1;
+        while (slotsLength < 2 * (U32)uniformsLength) slotsLength *= 2;
+        uniformSlots.assign(slotsLength, UniformSlot());
+        uniformSlotMask = slotsLength - 1;
+
+        std::vector<GLchar> name(maxNameLength + 1);
+        for (GLint uniform = 0; uniform < uniformsLength; uniform += 1)
+        {
+            GLint  size;
+            GLenum type;
+            glGetActiveUniform(ID, uniform, name.size(), nullptr, &size, &type, name.data());
+            I32 location = glGetUniformLocation(ID, name.data());
+            if (location < 0) continue;  // in a uniform block
+
+            // arrays are reported as "name[0]" and set by their plain name
+            std::string uniformName = name.data();
+            if (uniformName.size() > 3 && uniformName.compare(uniformName.size() - 3, 3, "[0]") == 0) uniformName.resize(uniformName.size() - 3);
+
+            U32 hash = hashUniformName(uniformName.c_str());
+            U32 slot = hash & uniformSlotMask;
+            while (uniformSlots[slot].location != -1) slot = (slot + 1) & uniformSlotMask;
+            uniformSlots[slot] = {hash, location, uniformName};
+        }
+
+        U32 frameBlock = glGetUniformBlockIndex(ID, "Frame");
+        if (frameBlock != GL_INVALID_INDEX) glUniformBlockBinding(ID, frameBlock, FRAME_UNIFORM_BINDING);
+    }
+
+    I32 getUniformLocation(UniformName name) const
+    {
+        if (uniformSlots.empty()) return -1;
+        for (U32 slot = name.hash & uniformSlotMask;; slot = (slot + 1) & uniformSlotMask)
+        {
+            const UniformSlot &uniformSlot = uniformSlots[slot];
+            if (uniformSlot.location == -1) return -1;
+            if (uniformSlot.hash == name.hash && uniformSlot.name == name.name) return uniformSlot.location;
+        }
+    }
+
+    // utility uniform functions, for uniforms outside Frame
     // ------------------------------------------------------------------------
-    void setBool(const std::string &name, bool value) const
+    void setBool(UniformName name, bool value) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), (I32)value);
+        glUniform1i(getUniformLocation(name), (I32)value);
     }
     // ------------------------------------------------------------------------
-    void setI32(const std::string &name, I32 n) const
+    void setI32(UniformName name, I32 n) const
     {
-        glUniform1i(glGetUniformLocation(ID, name.c_str()), n);
+        glUniform1i(getUniformLocation(name), n);
     }
     // ------------------------------------------------------------------------
-    void setF32(const std::string &name, F32 n) const
+    void setF32(UniformName name, F32 n) const
     {
-        glUniform1f(glGetUniformLocation(ID, name.c_str()), n);
+        glUniform1f(getUniformLocation(name), n);
     }
     // ------------------------------------------------------------------------
-    void setV2(const std::string &name, V2 &v)
+    void setV2(UniformName name, V2 v) const
     {
-        glUniform2fv(glGetUniformLocation(ID, name.c_str()), 1, v.front());
+        glUniform2fv(getUniformLocation(name), 1, v.front());
     }
     // ------------------------------------------------------------------------
-    void setV3(const std::string &name, V3 &v)
+    void setV3(UniformName name, V3 v) const
     {
-        glUniform3fv(glGetUniformLocation(ID, name.c_str()), 1, v.front());
+        glUniform3fv(getUniformLocation(name), 1, v.front());
     }
     // ------------------------------------------------------------------------
-    void setV4(const std::string &name, V4 &v)
+    void setV4(UniformName name, V4 v) const
     {
-        glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, v.front());
+        glUniform4fv(getUniformLocation(name), 1, v.front());
     }
     // ------------------------------------------------------------------------
-    void setM2(const std::string &name, M2 &m)
+    void setM2(UniformName name, M2 m) const
     {
-        glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, m.front());
+        glUniformMatrix2fv(getUniformLocation(name), 1, GL_FALSE, m.front());
     }
     // ------------------------------------------------------------------------
-    void setM3(const std::string &name, M3 &m)
+    void setM3(UniformName name, M3 m) const
     {
-        glUniformMatrix3fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, m.front());
+        glUniformMatrix3fv(getUniformLocation(name), 1, GL_FALSE, m.front());
     }
     // ------------------------------------------------------------------------
-    void setM4(const std::string &name, M4 &m)
+    void setM4(UniformName name, const M4 &m) const
     {
-        glUniformMatrix4fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE, m.front());
+        glUniformMatrix4fv(getUniformLocation(name), 1, GL_FALSE, &m.x.x);
     }
 
     // utility function for checking shader compilation/linking errors.
@@ -0,0 +1,66 @@
+#pragma once
+
+#include "math.hpp"
+#include "parallel.hpp"
+#include "types.hpp"
+
+#include <vector>
+
+// One level of subdivision as a sparse matrix: refined vertex row is the sum
+// of weights[i] * positions[sources[i]] over i in [offsets[row], offsets[row + 1]),
+// where positions are the vertices of the level before. Built once from the
+// connectivity by WingedEdgeMesh::createStencilTables(), after which moving
+// the control vertices only costs one apply() per level.
+struct StencilTable
+{
+    std::vector<U32> offsets;
+    std::vector<U32> sources;
+    std::vector<F32> weights;
+
+    U32 getRowsLength() const
+    {
+        return offsets.empty() ? 0 : offsets.size() - 1;
+    }
+
+    // moves row r to newRows[r], for when the refined vertices are renumbered
+    void reorderRows(const U32* newRows)
+    {
+        U32              rowsLength = getRowsLength();
+        std::vector<U32> newOffsets(rowsLength + 1, 0);
+        for (U32 row = 0; row < rowsLength; row += 1)
+        {
+            newOffsets[newRows[row] + 1] = offsets[row + 1] - offsets[row];
+        }
+        for (U32 row = 0; row < rowsLength; row += 1)
+        {
+            newOffsets[row + 1] += newOffsets[row];
+        }
+
+        std::vector<U32> newSources(sources.size());
+        std::vector<F32> newWeights(weights.size());
+        for (U32 row = 0; row < rowsLength; row += 1)
+        {
+            std::copy(&sources[0] + offsets[row], &sources[0] + offsets[row + 1], &newSources[0] + newOffsets[newRows[row]]);
+            std::copy(&weights[0] + offsets[row], &weights[0] + offsets[row + 1], &newWeights[0] + newOffsets[newRows[row]]);
+        }
+        offsets = std::move(newOffsets);
+        sources = std::move(newSources);
+        weights = std::move(newWeights);
+    }
+
+    void apply(const V3* positions, V3* refinedPositions) const
+    {
+        parallelFor(getRowsLength(), [&](U32 begin, U32 end) {
+            for (U32 row = begin; row < end; row += 1)
+            {
+                V3 sum;
+                for (U32 index = offsets[row]; index < offsets[row + 1]; index += 1)
+                {
+                    V3 position = positions[sources[index]];
+                    sum = sum + position * weights[index];
+                }
+                refinedPositions[row] = sum;
+            }
+        });
+    }
+};
@@ -0,0 +1,280 @@
+#pragma once
+
+#include "arena.hpp"
+#include "cache.hpp"
+#include "math.hpp"
+#include "types.hpp"
+
+#include <algorithm>
+
+// Reordering of triangle lists for the GPU's post-transform vertex cache,
+// after Sander, Nehab and Barczak, "Fast Triangle Reordering for Vertex
+// Locality and Reduced Overdraw" (2007). All scratch comes from the arena.
+
+// cache size the orders are optimized and measured for, in vertices
+const U32 VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStatistics
+{
+    F32 acmr = 0;  // average cache misses per triangle, 0.5 at best on a large closed mesh
+    F32 atvr = 0;  // average transforms per vertex, cache misses over vertices used, 1 at best
+};
+
+// Runs the triangle list through a FIFO cache of cacheSize vertices.
+VertexCacheStatistics getVertexCacheStatistics(Arena& arena, const U32* indices, U32 indicesLength, U32 verticesLength, U32 cacheSize = VERTEX_CACHE_SIZE)
+{
+    // a vertex is cached if fewer than cacheSize misses happened since its own
+    U32* missTimes = arena.allocate<U32>(verticesLength);
+    std::fill(missTimes, missTimes + verticesLength, NO_INDEX);
+
+    U32 misses = 0, usedVertices = 0;
+    for (U32 corner = 0; corner < indicesLength; corner += 1)
+    {
+        U32 vertex = indices[corner];
+        if (missTimes[vertex] != NO_INDEX && misses - missTimes[vertex] < cacheSize) continue;
+        if (missTimes[vertex] == NO_INDEX) usedVertices += 1;
+        missTimes[vertex] = misses;
+        misses += 1;
+    }
+
+    VertexCacheStatistics statistics;
+    if (0 < indicesLength) statistics.acmr = (F32)misses / (indicesLength / 3);
+    if (0 < usedVertices) statistics.atvr = (F32)misses / usedVertices;
+    return statistics;
+}
+
+// Tipsify: emits the faces around one vertex at a time, moving on to the
+// neighbour that is still cached and has the fewest faces left, so the cache
+// rarely has to take a vertex twice. Writes the old face number of every new
+// face to faceOrder and sets isBlockStart[face] where it had to jump to an
+// unrelated vertex, which flushes the cache.
+void orderFacesForVertexCache(Arena& arena, const U32* indices, U32 facesLength, U32 verticesLength, U32* faceOrder, U8* isBlockStart, U32 cacheSize = VERTEX_CACHE_SIZE)
+{
+    // the faces around every vertex, and how many of them are not emitted yet
+    U32* faceOffsets = arena.allocate<U32>(verticesLength + 1);
+    U32* vertexFaces = arena.allocate<U32>(facesLength * 3);
+    U32* liveFaces = arena.allocate<U32>(verticesLength);
+    std::fill(liveFaces, liveFaces + verticesLength, 0);
+    for (U32 corner = 0; corner < facesLength * 3; corner += 1)
+    {
+        liveFaces[indices[corner]] += 1;
+    }
+    faceOffsets[0] = 0;
+    for (U32 vertex = 0; vertex < verticesLength; vertex += 1)
+    {
+        faceOffsets[vertex + 1] = faceOffsets[vertex] + liveFaces[vertex];
+    }
+    U32* nextSlots = arena.allocate<U32>(verticesLength);
+    std::copy(faceOffsets, faceOffsets + verticesLength, nextSlots);
+    for (U32 corner = 0; corner < facesLength * 3; corner += 1)
+    {
+        vertexFaces[nextSlots[indices[corner]]++] = corner / 3;
+    }
+
+    // cache times as in the paper: a vertex is cached if fewer than cacheSize
+    // vertices went in after it
+    U32* cacheTimes = arena.allocate<U32>(verticesLength);
+    std::fill(cacheTimes, cacheTimes + verticesLength, 0);
+    U32 time = cacheSize + 1;
+
+    U8* isEmitted = arena.allocate<U8>(facesLength);
+    std::fill(isEmitted, isEmitted + facesLength, 0);
+    std::fill(isBlockStart, isBlockStart + facesLength, 0);
+
+    // every vertex of every emitted face is pushed, so the candidates for the
+    // next fan are the top of this stack and dead ends the rest of it
+    U32* deadEnds = arena.allocate<U32>(facesLength * 3);
+    U32  deadEndsLength = 0;
+    U32  scanVertex = 0;
+    U32  emitted = 0;
+
+    // a vertex with faces left, from the dead-end stack or else in input order
+    auto skipDeadEnd = [&]() -> U32 {
+        while (0 < deadEndsLength)
+        {
+            U32 vertex = deadEnds[--deadEndsLength];
+            if (0 < liveFaces[vertex]) return vertex;
+        }
+        for (; scanVertex < verticesLength; scanVertex += 1)
+        {
+            if (0 < liveFaces[scanVertex]) return scanVertex;
+        }
+        return NO_INDEX;
+    };
+
+    U32 fanVertex = skipDeadEnd();
+    if (fanVertex != NO_INDEX && 0 < facesLength) isBlockStart[0] = 1;
+    while (fanVertex != NO_INDEX)
+    {
+        U32 candidatesBegin = deadEndsLength;
+        for (U32 slot = faceOffsets[fanVertex]; slot < faceOffsets[fanVertex + 1]; slot += 1)
+        {
+            U32 face = vertexFaces[slot];
+            if (isEmitted[face]) continue;
+            isEmitted[face] = 1;
+            faceOrder[emitted++] = face;
+
+            for (U32 corner = face * 3; corner < face * 3 + 3; corner += 1)
+            {
+                U32 vertex = indices[corner];
+                deadEnds[deadEndsLength++] = vertex;
+                liveFaces[vertex] -= 1;
+                if (cacheSize < time - cacheTimes[vertex])
+                {
+                    cacheTimes[vertex] = time;
+                    time += 1;
+                }
+            }
+        }
+
+        // the candidate that stays cached through its remaining faces and has
+        // been there longest, any cached one if none stays, else a dead end
+        U32 nextVertex = NO_INDEX;
+        I64 bestPriority = -1;
+        for (U32 slot = candidatesBegin; slot < deadEndsLength; slot += 1)
+        {
+            U32 vertex = deadEnds[slot];
+            if (liveFaces[vertex] == 0) continue;
+
+            I64 priority = 0;
+            if (time - cacheTimes[vertex] + 2 * liveFaces[vertex] <= cacheSize) priority = time - cacheTimes[vertex];
+            if (bestPriority < priority)
+            {
+                bestPriority = priority;
+                nextVertex = vertex;
+            }
+        }
+        if (nextVertex == NO_INDEX)
+        {
+            nextVertex = skipDeadEnd();
+            if (nextVertex != NO_INDEX && emitted < facesLength) isBlockStart[emitted] = 1;
+        }
+        fanVertex = nextVertex;
+    }
+}
+
+// Cuts every block of faceOrder into clusters where the cache misses so far
+// are no worse than lambda times the block's own rate, then sorts the
+// clusters by how far they face away from the middle of the mesh. Faces on
+// the outside, which tend to hide the rest, are drawn first, at little cost
+// to the vertex cache because clusters only end where it was doing well.
+// This only pays off for self-occluding meshes drawn with back faces culled.
+void orderClustersForOverdraw(Arena& arena, const U32* indices, const V3* positions, U32 facesLength, U32 verticesLength, U32* faceOrder, const U8* isBlockStart, F32 lambda = 1.0f, U32 cacheSize = VERTEX_CACHE_SIZE)
+{
+    if (facesLength == 0) return;
+
+    // misses per face in the current order
+    U32* missTimes = arena.allocate<U32>(verticesLength);
+    std::fill(missTimes, missTimes + verticesLength, NO_INDEX);
+    U8* faceMisses = arena.allocate<U8>(facesLength);
+    U32 misses = 0;
+    for (U32 face = 0; face < facesLength; face += 1)
+    {
+        faceMisses[face] = 0;
+        for (U32 corner = faceOrder[face] * 3; corner < faceOrder[face] * 3 + 3; corner += 1)
+        {
+            U32 vertex = indices[corner];
+            if (missTimes[vertex] != NO_INDEX && misses - missTimes[vertex] < cacheSize) continue;
+            missTimes[vertex] = misses;
+            misses += 1;
+            faceMisses[face] += 1;
+        }
+    }
+
+    // first face of every cluster, with one past the last face at the end
+    U32* clusterStarts = arena.allocate<U32>(facesLength + 1);
+    U32  clustersLength = 0;
+    for (U32 blockStart = 0; blockStart < facesLength;)
+    {
+        U32 blockEnd = blockStart + 1;
+        U32 blockMisses = faceMisses[blockStart];
+        while (blockEnd < facesLength && !isBlockStart[blockEnd]) blockMisses += faceMisses[blockEnd++];
+        F32 blockRate = (F32)blockMisses / (blockEnd - blockStart);
+
+        U32 clusterMisses = 0;
+        clusterStarts[clustersLength++] = blockStart;
+        for (U32 face = blockStart; face < blockEnd; face += 1)
+        {
+            clusterMisses += faceMisses[face];
+            U32 clusterFaces = face + 1 - clusterStarts[clustersLength - 1];
+            if (cacheSize <= clusterFaces && face + 1 < blockEnd && clusterMisses <= lambda * blockRate * clusterFaces)
+            {
+                clusterStarts[clustersLength++] = face + 1;
+                clusterMisses = 0;
+            }
+        }
+        blockStart = blockEnd;
+    }
+    clusterStarts[clustersLength] = facesLength;
+
+    // area weighted centroid of the mesh, then of every cluster with its normal
+    V3 meshCentroid;
+    F32 meshArea = 0;
+    F32* clusterKeys = arena.allocate<F32>(clustersLength);
+    V3*  clusterCentroids = arena.allocate<V3>(clustersLength);
+    V3*  clusterNormals = arena.allocate<V3>(clustersLength);
+    for (U32 cluster = 0; cluster < clustersLength; cluster += 1)
+    {
+        V3  centroidSum, normalSum;
+        F32 areaSum = 0;
+        for (U32 face = clusterStarts[cluster]; face < clusterStarts[cluster + 1]; face += 1)
+        {
+            V3 position1 = positions[indices[faceOrder[face] * 3 + 0]];
+            V3 position2 = positions[indices[faceOrder[face] * 3 + 1]];
+            V3 position3 = positions[indices[faceOrder[face] * 3 + 2]];
+
+            V3  areaNormal = cross(position1 - position2, position1 - position3);
+            F32 area = length(areaNormal);
+            centroidSum = centroidSum + (position1 + position2 + position3) * (area / 3);
+            normalSum = normalSum + areaNormal;
+            areaSum += area;
+        }
+        clusterCentroids[cluster] = 0 < areaSum ? centroidSum * (1 / areaSum) : V3();
+        clusterNormals[cluster] = normalSum;
+        meshCentroid = meshCentroid + centroidSum;
+        meshArea += areaSum;
+    }
+    if (0 < meshArea) meshCentroid = meshCentroid * (1 / meshArea);
+
+    U32* clusters = arena.allocate<U32>(clustersLength);
+    for (U32 cluster = 0; cluster < clustersLength; cluster += 1)
+    {
+        V3  normal = clusterNormals[cluster];
+        F32 normalLength = length(normal);
+        clusterKeys[cluster] = 0 < normalLength ? dot(clusterCentroids[cluster] - meshCentroid, normal) / normalLength : 0;
+        clusters[cluster] = cluster;
+    }
+    std::stable_sort(clusters, clusters + clustersLength, [&](U32 a, U32 b) { return clusterKeys[b] < clusterKeys[a]; });
+
+    U32* sortedOrder = arena.allocate<U32>(facesLength);
+    U32  sortedLength = 0;
+    for (U32 clusterIndex = 0; clusterIndex < clustersLength; clusterIndex += 1)
+    {
+        U32 cluster = clusters[clusterIndex];
+        for (U32 face = clusterStarts[cluster]; face < clusterStarts[cluster + 1]; face += 1)
+        {
+            sortedOrder[sortedLength++] = faceOrder[face];
+        }
+    }
+    std::copy(sortedOrder, sortedOrder + facesLength, faceOrder);
+}
+
+// Numbers the vertices in the order the faces first use them, so vertex
+// fetches walk the buffer forwards. Unused vertices go last, in their old
+// order. Writes the new number of every old vertex to vertexRemap.
+void orderVerticesForFetch(const U32* indices, U32 facesLength, U32 verticesLength, const U32* faceOrder, U32* vertexRemap)
+{
+    std::fill(vertexRemap, vertexRemap + verticesLength, NO_INDEX);
+    U32 next = 0;
+    for (U32 face = 0; face < facesLength; face += 1)
+    {
+        for (U32 corner = faceOrder[face] * 3; corner < faceOrder[face] * 3 + 3; corner += 1)
+        {
+            if (vertexRemap[indices[corner]] == NO_INDEX) vertexRemap[indices[corner]] = next++;
+        }
+    }
+    for (U32 vertex = 0; vertex < verticesLength; vertex += 1)
+    {
+        if (vertexRemap[vertex] == NO_INDEX) vertexRemap[vertex] = next++;
+    }
+}